@@ -0,0 +1,141 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <limits>
+#include <cmath>
+#include <stdexcept>
+#include "common.h"
+#include "init.h"
+#include "partition.h"
+using namespace std;
+
+void compute_new_grid(const unsigned int grid_type);
+
+namespace G2G {
+
+#define AUTOTUNE_REPETITIONS 3
+#define AUTOTUNE_FILE "gpu_options.autotuned"
+
+/* a tuned option and the values tried for it */
+struct TunedOption {
+  const char* name;
+  double* double_value;
+  uint* uint_value;
+  std::vector<double> candidates;
+
+  double get(void) const { return (double_value ? *double_value : *uint_value); }
+  void set(double value) { if (double_value) *double_value = value; else *uint_value = (uint)value; }
+};
+
+static TunedOption tuned_option(const char* name, double* double_value, uint* uint_value, const double* candidates, uint count) {
+  TunedOption option;
+  option.name = name;
+  option.double_value = double_value;
+  option.uint_value = uint_value;
+  option.candidates.assign(candidates, candidates + count);
+  return option;
+}
+
+/* builds the grid with the current options and returns the XC energy of the current density,
+ * along with the fastest of a few evaluations */
+static double evaluate(double& seconds) {
+  compute_new_grid(fortran_vars.grid_type);
+
+  double energy = 0;
+  seconds = numeric_limits<double>::max();
+  for (uint i = 0; i < AUTOTUNE_REPETITIONS; i++) {
+    Timers timers;
+    double t0 = report_clock();
+    partition.solve(timers, false, fortran_vars.lda, false, true, &energy, NULL, fortran_vars.OPEN);
+    seconds = min(seconds, report_clock() - t0);
+  }
+  return energy;
+}
+
+/* copies the gpu_options file without the tuned options (nor autotune_tolerance) and appends their new values */
+static void write_options(const vector<TunedOption>& options) {
+  ofstream out(AUTOTUNE_FILE);
+  if (!out) throw runtime_error("Could not write " AUTOTUNE_FILE);
+  out.precision(10);
+
+  ifstream f("gpu_options");
+  string option, value;
+  while (f >> option >> value) {
+    bool tuned = (option == "autotune_tolerance");
+    for (uint i = 0; i < options.size(); i++) tuned = tuned || (option == options[i].name);
+    if (!tuned) out << option << " " << value << endl;
+  }
+
+  for (uint i = 0; i < options.size(); i++) out << options[i].name << " " << options[i].get() << endl;
+}
+
+/**
+ * Coordinate descent over the grid options: each option in turn takes the value that gives the fastest
+ * XC evaluation whose energy stays within autotune_tolerance of a reference computed with conservative
+ * screening. The result is written to gpu_options.autotuned and used for the rest of the run.
+ */
+void autotune_grid(void) {
+  cout << "<====== autotune ========>" << endl;
+
+  static const double cube_sizes[] = { 4, 6, 8, 10, 12, 15.5, 20 };
+  static const double sphere_radii[] = { 0, 0.2, 0.4, 0.6, 0.8, 1 };
+  static const double min_points[] = { 1, 4, 16, 64 };
+  static const double exponents[] = { 6, 8, 10, 12, 14 };
+  static const double becke_cutoffs[] = { 1e-5, 1e-6, 1e-7, 1e-8, 1e-9 };
+
+  vector<TunedOption> options;
+  options.push_back(tuned_option("little_cube_size", &little_cube_size, NULL, cube_sizes, sizeof(cube_sizes) / sizeof(double)));
+  options.push_back(tuned_option("sphere_radius", &sphere_radius, NULL, sphere_radii, sizeof(sphere_radii) / sizeof(double)));
+  options.push_back(tuned_option("min_points_per_cube", NULL, &min_points_per_cube, min_points, sizeof(min_points) / sizeof(double)));
+  options.push_back(tuned_option("max_function_exponent", NULL, &max_function_exponent, exponents, sizeof(exponents) / sizeof(double)));
+  options.push_back(tuned_option("becke_cutoff", &becke_cutoff, NULL, becke_cutoffs, sizeof(becke_cutoffs) / sizeof(double)));
+
+  vector<double> initial;
+  for (uint i = 0; i < options.size(); i++) initial.push_back(options[i].get());
+
+  // reference: every point and no function screened beyond exp(-16)
+  double seconds;
+  min_points_per_cube = 1;
+  max_function_exponent = max(max_function_exponent, 16u);
+  becke_cutoff = min(becke_cutoff, 1e-12);
+  double reference = evaluate(seconds);
+  cout << "autotune: reference energy " << reference << " (" << seconds << " s)" << endl;
+  for (uint i = 0; i < options.size(); i++) options[i].set(initial[i]);
+
+  double best_seconds;
+  bool best_valid = (fabs(evaluate(best_seconds) - reference) <= autotune_tolerance);
+
+  for (uint i = 0; i < options.size(); i++) {
+    double best_value = options[i].get();
+    for (uint j = 0; j < options[i].candidates.size(); j++) {
+      double value = options[i].candidates[j];
+      if (value == best_value) continue;
+
+      options[i].set(value);
+      double energy = evaluate(seconds);
+      bool valid = (fabs(energy - reference) <= autotune_tolerance);
+      cout << "autotune: " << options[i].name << " " << value << ": " << seconds << " s, error " << energy - reference << endl;
+
+      if (valid && (!best_valid || seconds < best_seconds)) {
+        best_value = value;
+        best_seconds = seconds;
+        best_valid = true;
+      }
+    }
+    options[i].set(best_value);
+  }
+
+  if (!best_valid) {
+    cout << "autotune: no configuration within tolerance, keeping the initial options" << endl;
+    for (uint i = 0; i < options.size(); i++) options[i].set(initial[i]);
+  }
+  else {
+    write_options(options);
+    cout << "autotune: " << best_seconds << " s per evaluation, options written to " AUTOTUNE_FILE << endl;
+  }
+
+  compute_new_grid(fortran_vars.grid_type);
+}
+
+}
@@ -0,0 +1,128 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <stdexcept>
+#include "common.h"
+#include "init.h"
+#include "matrix.h"
+#include "capture.h"
+using namespace std;
+
+namespace G2G {
+
+static ofstream capture_stream;
+
+static void write_uint(uint32_t value) {
+  capture_stream.write((const char*)&value, sizeof(value));
+}
+
+static void write_double(double value) {
+  capture_stream.write((const char*)&value, sizeof(value));
+}
+
+static void write_matrix(const FortranMatrix<double>& m) {
+  for (uint j = 0; j < m.height; j++) {
+    for (uint i = 0; i < m.width; i++) write_double(m(i, j));
+  }
+}
+
+static void write_packed(const FortranMatrix<double>& m) {
+  for (uint k = 0; k < (fortran_vars.m * (fortran_vars.m + 1)) / 2; k++) write_double(m.data[k]);
+}
+
+void capture_parameters(void) {
+  if (capture_file.empty()) return;
+
+  capture_stream.close();
+  capture_stream.clear();
+  capture_stream.open(capture_file.c_str(), ios::binary);
+  if (!capture_stream) throw runtime_error(string("Could not open capture file ") + capture_file);
+  capture_stream.write(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+
+  write_uint(CAPTURE_PARAMETERS);
+  write_uint(fortran_vars.normalize);
+  write_uint(fortran_vars.atoms);
+  write_uint(fortran_vars.gaussians);
+  write_uint(fortran_vars.m);
+  write_uint(fortran_vars.nco);
+  write_uint(fortran_vars.OPEN);
+  write_uint(fortran_vars.OPEN ? fortran_vars.nunp : 0);
+  write_uint(fortran_vars.do_forces ? 2 : 0);
+  write_uint(fortran_vars.iexch);
+  write_uint(fortran_vars.d_components);
+  write_uint(fortran_vars.s_funcs);
+  write_uint(fortran_vars.p_funcs * 3);
+  write_uint(fortran_vars.d_funcs * fortran_vars.d_components);
+
+  for (uint i = 0; i < fortran_vars.atoms; i++) {
+    write_uint(fortran_vars.atom_types(i) + 1);
+    write_uint(fortran_vars.shells1(i));
+    write_uint(fortran_vars.shells2(i));
+    write_double(fortran_vars.rm(i));
+  }
+
+  for (uint i = 0; i < fortran_vars.m; i++) {
+    write_uint(fortran_vars.nucleii(i));
+    write_uint(fortran_vars.contractions(i));
+  }
+
+  for (uint j = 0; j < MAX_CONTRACTIONS; j++) {
+    for (uint i = 0; i < fortran_vars.m; i++) write_double(fortran_vars.a_values(i, j));
+  }
+  for (uint j = 0; j < MAX_CONTRACTIONS; j++) {
+    for (uint i = 0; i < fortran_vars.m; i++) write_double(fortran_vars.c_values(i, j));
+  }
+
+  write_matrix(fortran_vars.e1);
+  write_matrix(fortran_vars.e2);
+  write_matrix(fortran_vars.e3);
+  write_matrix(fortran_vars.wang1);
+  write_matrix(fortran_vars.wang2);
+  write_matrix(fortran_vars.wang3);
+  capture_stream.flush();
+
+  cout << "capturing g2g inputs to " << capture_file << endl;
+}
+
+void capture_positions(uint32_t grid_type) {
+  if (!capture_stream.is_open()) return;
+
+  write_uint(CAPTURE_POSITIONS);
+  write_uint(grid_type);
+  for (uint k = 0; k < 3; k++) {
+    for (uint i = 0; i < fortran_vars.atoms; i++) write_double(fortran_vars.atom_positions_pointer(i, k));
+  }
+  capture_stream.flush();
+}
+
+void capture_new_grid(uint32_t grid_type) {
+  if (!capture_stream.is_open()) return;
+
+  write_uint(CAPTURE_NEW_GRID);
+  write_uint(grid_type);
+  capture_stream.flush();
+}
+
+void capture_convergence(double good) {
+  if (!capture_stream.is_open()) return;
+
+  write_uint(CAPTURE_CONVERGENCE);
+  write_double(good);
+  capture_stream.flush();
+}
+
+void capture_solve(uint32_t computation_type, double energy) {
+  if (!capture_stream.is_open()) return;
+
+  write_uint(CAPTURE_SOLVE);
+  write_uint(computation_type);
+  write_double(energy);
+  if (fortran_vars.OPEN) {
+    write_packed(fortran_vars.rmm_dens_a);
+    write_packed(fortran_vars.rmm_dens_b);
+  }
+  else write_packed(fortran_vars.rmm_input_ndens1);
+  capture_stream.flush();
+}
+
+}
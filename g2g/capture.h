@@ -0,0 +1,35 @@
+#ifndef __G2G_CAPTURE_H__
+#define __G2G_CAPTURE_H__
+
+#include <stdint.h>
+
+namespace G2G {
+  /**
+   * Capture of the inputs of a g2g run (option capture_file), replayed by tools/replay without LIO.
+   * The file starts with CAPTURE_MAGIC followed by records: an uint32 tag and its payload, where
+   * every integer is an uint32 and every real a double (native byte order).
+   *
+   * CAPTURE_PARAMETERS: norm, atoms, gaussians, m, nco, open, nunp, nopt, iexch, d_components, nshell[3],
+   *                     for each atom Iz, Nr[Iz], Nr2[Iz], Rm[Iz], for each function Nuc, ncont,
+   *                     a and c (m x MAX_CONTRACTIONS, function index fastest),
+   *                     e, e2, e3 (grid size x 3, point index fastest), wang, wang2, wang3
+   * CAPTURE_POSITIONS:  grid type, positions (atoms x 3, atom index fastest)
+   * CAPTURE_NEW_GRID:   grid type
+   * CAPTURE_CONVERGENCE: SCF convergence criterion
+   * CAPTURE_SOLVE:      computation type, resulting energy, packed density (m * (m + 1) / 2; alpha and beta if open)
+   */
+  #define CAPTURE_MAGIC "G2GCAP1"
+
+  enum CaptureTag {
+    CAPTURE_PARAMETERS = 1, CAPTURE_POSITIONS = 2, CAPTURE_NEW_GRID = 3, CAPTURE_CONVERGENCE = 4, CAPTURE_SOLVE = 5
+  };
+
+  // all of these do nothing unless capture_file is set
+  void capture_parameters(void);
+  void capture_positions(uint32_t grid_type);
+  void capture_new_grid(uint32_t grid_type);
+  void capture_convergence(double good);
+  void capture_solve(uint32_t computation_type, double energy);
+}
+
+#endif
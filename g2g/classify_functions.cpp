@@ -11,30 +11,40 @@ using namespace std;
 using namespace G2G;
 
 
+/* squared distance from a point to the axis-aligned box [box_min, box_max] */
+static double box_distance2(const double3& pos, const double3& box_min, const double3& box_max)
+{
+  double3 dist_vec;
+
+  for (uint j = 0; j < 3; j++) {
+    if (elem(pos,j) < elem(box_min,j))
+      elem(dist_vec,j) = elem(box_min,j) - elem(pos,j);
+    else if (elem(pos,j) > elem(box_max,j))
+      elem(dist_vec,j) = elem(pos,j) - elem(box_max,j);
+    else
+      elem(dist_vec,j) = 0;
+  }
+
+  return length2(dist_vec);
+}
+
 /*******************************
  * Cube
  *******************************/
 
 void Cube::assign_significative_functions(const double3& cube_coord, const vector<double>& min_exps, const vector<double>& min_coeff)
+{
+  double3 cube_end = cube_coord + make_double3(little_cube_size, little_cube_size, little_cube_size);
+  assign_significative_functions(cube_coord, cube_end, min_exps, min_coeff);
+}
+
+void Cube::assign_significative_functions(const double3& box_min, const double3& box_max, const vector<double>& min_exps, const vector<double>& min_coeff)
 {
   uint func = 0;
 
   HostMatrix<double> atom_cube_dists(fortran_vars.atoms);
-  for (uint i = 0; i < fortran_vars.atoms; i++) {
-    const double3& atom_pos = fortran_vars.atom_positions(i);
-    double3 dist_vec;
-
-    for (uint j = 0; j < 3; j++) {
-      if (elem(atom_pos,j) < elem(cube_coord,j))
-        elem(dist_vec,j) = elem(cube_coord,j) - elem(atom_pos,j);
-      else if (elem(atom_pos,j) > (elem(cube_coord,j) + little_cube_size))
-        elem(dist_vec,j) = elem(atom_pos,j) - (elem(cube_coord,j) + little_cube_size);
-      else
-        elem(dist_vec,j) = 0;
-    }
-
-    atom_cube_dists(i) = length2(dist_vec);
-  }
+  for (uint i = 0; i < fortran_vars.atoms; i++)
+    atom_cube_dists(i) = box_distance2(fortran_vars.atom_positions(i), box_min, box_max);
 
   set<uint> functions_set;
   set<uint> nucleii_set;
@@ -60,13 +70,13 @@ void Cube::assign_significative_functions(const double3& cube_coord, const vecto
   }
 
   /** D **/
-  while (func < fortran_vars.s_funcs + fortran_vars.p_funcs * 3 + fortran_vars.d_funcs * 6) {
+  while (func < fortran_vars.s_funcs + fortran_vars.p_funcs * 3 + fortran_vars.d_funcs * fortran_vars.d_components) {
     uint atom_nuc = fortran_vars.nucleii(func) - 1;
     if (assign_all_functions || is_significative(FUNCTION_D, min_exps[func], min_coeff[func], atom_cube_dists(atom_nuc))) {
       functions_set.insert(func); d_functions++;
       nucleii_set.insert(atom_nuc);
     }
-    func += 6;
+    func += fortran_vars.d_components;
   }
 
   local2global_func.resize(functions_set.size());
@@ -84,10 +94,20 @@ void Cube::assign_significative_functions(const double3& cube_coord, const vecto
 void Sphere::assign_significative_functions(const std::vector<double>& min_exps, const std::vector<double>& min_coeff) {
    uint func = 0;
 
+  // without points there is no bounding box, and the sphere is left without functions (as an empty cube would)
+  if (points.empty()) return;
+
   // TODO: esto solo es necesario para los atomos en nucleii, idem arriba
   HostMatrix<double> atom_sphere_dists(fortran_vars.atoms);
   const double3& own_atom_pos = fortran_vars.atom_positions(atom);
 
+  // a sphere split into slabs/sectors covers only part of the ball, so the bounding box of its points gives a tighter bound
+  double3 box_min = points.front().position, box_max = points.front().position;
+  for (vector<Point>::const_iterator p = points.begin(); p != points.end(); ++p) {
+    box_min = make_double3(min(box_min.x, p->position.x), min(box_min.y, p->position.y), min(box_min.z, p->position.z));
+    box_max = make_double3(max(box_max.x, p->position.x), max(box_max.y, p->position.y), max(box_max.z, p->position.z));
+  }
+
   for (uint i = 0; i < fortran_vars.atoms; i++) {
     if (i == atom) atom_sphere_dists(i) = 0;
     else {
@@ -95,7 +115,7 @@ void Sphere::assign_significative_functions(const std::vector<double>& min_exps,
       double3 dist_vec = (atom_pos - own_atom_pos);
       double dist_to_atom = length(dist_vec);
       double dist = (radius > dist_to_atom ? 0 : dist_to_atom - radius);
-      atom_sphere_dists(i) = dist * dist;
+      atom_sphere_dists(i) = max(dist * dist, box_distance2(atom_pos, box_min, box_max));
     }
   }
 
@@ -124,13 +144,13 @@ void Sphere::assign_significative_functions(const std::vector<double>& min_exps,
   }
 
   /** D **/
-  while (func < fortran_vars.s_funcs + fortran_vars.p_funcs * 3 + fortran_vars.d_funcs * 6) {
+  while (func < fortran_vars.s_funcs + fortran_vars.p_funcs * 3 + fortran_vars.d_funcs * fortran_vars.d_components) {
     uint atom_nuc = fortran_vars.nucleii(func) - 1;
     if (assign_all_functions || is_significative(FUNCTION_D, min_exps[func], min_coeff[func], atom_sphere_dists(atom_nuc))) {
       functions_set.insert(func); d_functions++;
       nucleii_set.insert(atom_nuc);
     }
-    func += 6;
+    func += fortran_vars.d_components;
   }
 
   local2global_func.resize(functions_set.size());
@@ -0,0 +1,102 @@
+#include <cmath>
+#include <vector>
+#include <algorithm>
+#include "../common.h"
+#include "../matrix.h"
+#include "compressed_matrix.h"
+using namespace std;
+
+namespace G2G {
+
+#define COMPRESSED_MAX_VALUE 32767.0
+
+template<class scalar_type> CompressedMatrix<scalar_type>::CompressedMatrix(void) : width(0), height(0), components(0) { }
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::compress_values(const scalar_type* data, size_t count) {
+  size_t blocks = (count + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE;
+  values.resize(count);
+  scales.resize(blocks);
+
+  for (size_t b = 0; b < blocks; b++) {
+    size_t first = b * COMPRESSED_BLOCK_SIZE;
+    size_t last = min(first + COMPRESSED_BLOCK_SIZE, count);
+
+    double magnitude = 0;
+    for (size_t i = first; i < last; i++) magnitude = max(magnitude, fabs((double)data[i]));
+    scales[b] = (float)magnitude;
+
+    double factor = (magnitude == 0 ? 0 : COMPRESSED_MAX_VALUE / magnitude);
+    for (size_t i = first; i < last; i++) values[i] = (short)floor(data[i] * factor + 0.5);
+  }
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::decompress_values(scalar_type* data) const {
+  for (size_t b = 0; b < scales.size(); b++) {
+    size_t first = b * COMPRESSED_BLOCK_SIZE;
+    size_t last = min(first + COMPRESSED_BLOCK_SIZE, values.size());
+
+    double factor = scales[b] / COMPRESSED_MAX_VALUE;
+    for (size_t i = first; i < last; i++) data[i] = (scalar_type)(values[i] * factor);
+  }
+}
+
+template<class scalar_type> scalar_type CompressedMatrix<scalar_type>::decompressed_value(size_t i) const {
+  return (scalar_type)(values[i] * (scales[i / COMPRESSED_BLOCK_SIZE] / COMPRESSED_MAX_VALUE));
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::compress(const HostMatrix<scalar_type>& m) {
+  width = m.width; height = m.height; components = 1;
+  compress_values(m.data, m.storage_elements()); // with the padding of the rows, restored by decompress as is
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::compress(const HostMatrix< vec_type<scalar_type,3> >& m) {
+  width = m.width; height = m.height; components = 3;
+
+  vector<scalar_type> flat(m.storage_elements() * 3);
+  for (uint i = 0; i < m.storage_elements(); i++) {
+    flat[3 * i + 0] = m.data[i].x();
+    flat[3 * i + 1] = m.data[i].y();
+    flat[3 * i + 2] = m.data[i].z();
+  }
+  compress_values(&flat[0], flat.size());
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::decompress(HostMatrix<scalar_type>& m) const {
+  assert(components == 1);
+  m.reshape(width, height);
+  assert(values.size() == m.storage_elements());
+  decompress_values(m.data);
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::decompress(HostMatrix< vec_type<scalar_type,3> >& m) const {
+  assert(components == 3);
+  m.reshape(width, height);
+  assert(values.size() == m.storage_elements() * 3);
+
+  for (uint i = 0; i < m.storage_elements(); i++)
+    m.data[i] = vec_type<scalar_type,3>(decompressed_value(3 * i + 0), decompressed_value(3 * i + 1), decompressed_value(3 * i + 2));
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::deallocate(void) {
+  vector<short>().swap(values);
+  vector<float>().swap(scales);
+  width = height = components = 0;
+}
+
+template<class scalar_type> void CompressedMatrix<scalar_type>::swap(CompressedMatrix<scalar_type>& other) {
+  std::swap(width, other.width); std::swap(height, other.height); std::swap(components, other.components);
+  values.swap(other.values);
+  scales.swap(other.scales);
+}
+
+template<class scalar_type> size_t CompressedMatrix<scalar_type>::bytes(void) const {
+  return values.size() * sizeof(short) + scales.size() * sizeof(float);
+}
+
+template<class scalar_type> size_t CompressedMatrix<scalar_type>::bytes(size_t count) {
+  return count * sizeof(short) + ((count + COMPRESSED_BLOCK_SIZE - 1) / COMPRESSED_BLOCK_SIZE) * sizeof(float);
+}
+
+template class CompressedMatrix<double>;
+template class CompressedMatrix<float>;
+}
@@ -0,0 +1,43 @@
+#ifndef __G2G_COMPRESSED_MATRIX_H__
+#define __G2G_COMPRESSED_MATRIX_H__
+
+#include <vector>
+#include "../matrix.h"
+
+namespace G2G {
+  /**
+   * Reduced precision storage for the cached function tables (CPU only).
+   * Every component is kept as a 16 bit integer scaled by the largest
+   * magnitude of its block, so each block of COMPRESSED_BLOCK_SIZE values
+   * costs 2 bytes per value plus one float.
+   */
+  #define COMPRESSED_BLOCK_SIZE 32
+
+  template<class scalar_type> class CompressedMatrix {
+    public:
+      CompressedMatrix(void);
+
+      void compress(const HostMatrix<scalar_type>& m);
+      void compress(const HostMatrix< vec_type<scalar_type,3> >& m);
+
+      void decompress(HostMatrix<scalar_type>& m) const;
+      void decompress(HostMatrix< vec_type<scalar_type,3> >& m) const;
+
+      void deallocate(void);
+      void swap(CompressedMatrix<scalar_type>& other);
+      bool is_allocated(void) const { return !values.empty(); }
+      size_t bytes(void) const;
+      static size_t bytes(size_t count); // of a compressed matrix of count values (components included)
+
+    private:
+      void compress_values(const scalar_type* data, size_t count);
+      void decompress_values(scalar_type* data) const;
+      scalar_type decompressed_value(size_t i) const;
+
+      unsigned int width, height, components;
+      std::vector<short> values;
+      std::vector<float> scales;
+  };
+}
+
+#endif
@@ -1,51 +1,140 @@
 #include <iostream>
 #include <fstream>
 #include <vector>
+#include <map>
 #include <cmath>
+#include <cstring>
+#include <limits>
 #include "../common.h"
 //#include "../cuda_includes.h"
 #include "../init.h"
 #include "../matrix.h"
 #include "../partition.h"
+#include "solve_buffers.h"
 using namespace std;
 
+#define SPHERICAL_D_Z2 0.288675134594812882 // 1 / (2 * sqrt(3))
+
 namespace G2G {
+/* Bound on |r^l exp(-a r^2)| and, when needed, on its gradient and hessian components, relative to exp(-a r^2),
+ * for every l <= max_l. The d outputs are combinations of at most two cartesian components, hence the factor 2 */
+static double primitive_factor_bound(double a, uint max_l, double r, bool forces, bool gga)
+{
+  double R = max(1.0, r);
+  double bound = 1;
+  if (forces || gga) bound = max(bound, max_l + 2 * a * R);
+  if (gga) bound = max(bound, max_l * max_l + (4 * max_l + 2) * a * R * R + 4 * a * a * R * R * R * R);
+  return (max_l == 2 ? 2 : 1) * pow(R, (double)max_l) * bound;
+}
+
+/* Square of the distance beyond which the primitive (with coefficient up to coeff) and its derivatives stay below
+ * exp(-max_function_exponent). Like is_significative, the radius is the largest root of
+ * a r^2 = max_function_exponent + log(coeff * factor(r)), found by fixed point iteration from above */
+static double primitive_cutoff_dist2(double a, double coeff, uint max_l, bool forces, bool gga)
+{
+  double x = 1;
+  while (a * x * x < max<double>(max_l + 4, 2 * (max_function_exponent + log(coeff * primitive_factor_bound(a, max_l, x, forces, gga)))))
+    x *= 2;
+
+  double delta;
+  do {
+    double x2 = (max_function_exponent + log(coeff * primitive_factor_bound(a, max_l, x, forces, gga))) / a;
+    double x1 = (x2 > 0 ? sqrt(x2) : 0);
+    delta = fabs(x - x1);
+    x = x1;
+  } while (delta > 0.01 && x > 0);
+  return (x + 0.01) * (x + 0.01);
+}
+
+/* Unique (atom, exponent) primitives of this group, sorted by atom: each exponential is evaluated once per point.
+ * With screen_primitives it is skipped beyond the distance where even the largest coefficient and angular
+ * factor using it leave the function (and its derivatives) below exp(-max_function_exponent) */
+template<class scalar_type>
+void PointGroup<scalar_type>::build_primitive_table(bool forces, bool gga)
+{
+  std::map<std::pair<uint, double>, std::pair<double, uint> > primitive_bounds; // largest coefficient and l
+  for (uint i = 0; i < total_functions_simple(); i++) {
+    uint global_func = local2global_func[i];
+    uint l = (i < s_functions ? 0 : (i < s_functions + p_functions ? 1 : 2));
+    for (uint contraction = 0; contraction < fortran_vars.contractions(global_func); contraction++) {
+      std::pair<double, uint>& bound = primitive_bounds[std::make_pair(func2global_nuc(i), fortran_vars.a_values(global_func, contraction))];
+      bound.first = max(bound.first, fabs(fortran_vars.c_values(global_func, contraction)));
+      bound.second = max(bound.second, l);
+    }
+  }
+
+  std::map<std::pair<uint, double>, uint> primitive_index;
+  primitive_nuc.clear(); primitive_exps.clear(); primitive_cutoffs.clear();
+  for (std::map<std::pair<uint, double>, std::pair<double, uint> >::const_iterator it = primitive_bounds.begin(); it != primitive_bounds.end(); ++it) {
+    double a = it->first.second;
+    primitive_index[it->first] = primitive_nuc.size();
+    primitive_nuc.push_back(it->first.first);
+    primitive_exps.push_back(a);
+    if (!screen_primitives) primitive_cutoffs.push_back(numeric_limits<scalar_type>::max());
+    else if (it->second.first == 0) primitive_cutoffs.push_back(0);
+    else primitive_cutoffs.push_back(primitive_cutoff_dist2(a, it->second.first, it->second.second, forces, gga));
+  }
+
+  func_primitives_start.assign(total_functions_simple() + 1, 0);
+  func_primitives.clear(); func_coeffs.clear();
+  for (uint i = 0; i < total_functions_simple(); i++) {
+    uint global_func = local2global_func[i];
+    for (uint contraction = 0; contraction < fortran_vars.contractions(global_func); contraction++) {
+      func_primitives.push_back(primitive_index[std::make_pair(func2global_nuc(i), fortran_vars.a_values(global_func, contraction))]);
+      func_coeffs.push_back(fortran_vars.c_values(global_func, contraction));
+    }
+    func_primitives_start[i + 1] = func_primitives.size();
+  }
+
+  primitive_table_flags = (forces ? 1 : 0) + (gga ? 2 : 0);
+}
+
 template<class scalar_type>
 void PointGroup<scalar_type>::compute_functions(bool forces, bool gga)
 {
-  /* Load group functions */
+  /* Load group functions (reshape: the tables may be the reused buffers of the solve) */
   uint group_m = total_functions();
 
-  function_values.resize(group_m, number_of_points);
-  if (forces || gga) gradient_values.resize(group_m, number_of_points);
-  if (gga) hessian_values.resize(group_m * 2, number_of_points);
+  function_values.reshape(group_m, number_of_points);
+  if (forces || gga) gradient_values.reshape(group_m, number_of_points);
+  if (gga) hessian_values.reshape(group_m * 2, number_of_points);
+
+  if (primitive_table_flags != (forces ? 1 : 0) + (gga ? 2 : 0)) build_primitive_table(forces, gga);
+
+#pragma omp parallel
+  {
+  std::vector<scalar_type>& primitive_values = solve_buffers<scalar_type>().primitive_values;
+  if (primitive_values.size() < primitive_nuc.size()) primitive_values.resize(primitive_nuc.size());
 
-  std::vector<Point> _points(points.begin(),points.end());
+#pragma omp for
+  for(int point = 0; point<points.size(); point++) {
+    vec_type3 point_position = vec_type3(points[point].position.x, points[point].position.y, points[point].position.z);
 
-#pragma omp parallel for
-  for(int point = 0; point<_points.size(); point++) {
-    vec_type3 point_position = vec_type3(_points[point].position.x, _points[point].position.y, _points[point].position.z);
+    // compute exponentials
+    scalar_type dist = 0;
+    for (uint prim = 0; prim < primitive_nuc.size(); prim++) {
+      if (prim == 0 || primitive_nuc[prim] != primitive_nuc[prim - 1]) {
+        vec_type3 v(point_position - vec_type3(fortran_vars.atom_positions(primitive_nuc[prim])));
+        dist = v.length2();
+      }
+      primitive_values[prim] = (dist > primitive_cutoffs[prim] ? 0 : exp(-primitive_exps[prim] * dist));
+    }
 
     for (uint i = 0, ii = 0; i < total_functions_simple(); i++) {
-      // compute exponential
       uint nuc = func2global_nuc(i);
       vec_type3 v(point_position - vec_type3(fortran_vars.atom_positions(nuc)));
-      scalar_type dist = v.length2();
 
       scalar_type t = 0, tg = 0, th = 0;
-      uint global_func = local2global_func[i];
-      uint contractions = fortran_vars.contractions(global_func);
-      for (uint contraction = 0; contraction < contractions; contraction++) {
-        scalar_type a = fortran_vars.a_values(global_func, contraction);
-        scalar_type c = fortran_vars.c_values(global_func, contraction);
-        scalar_type t0 = exp(-(a * dist)) * c;
+      for (uint k = func_primitives_start[i]; k < func_primitives_start[i + 1]; k++) {
+        uint prim = func_primitives[k];
+        scalar_type a = primitive_exps[prim];
+        scalar_type t0 = primitive_values[prim] * func_coeffs[k];
         t += t0;
         if (forces || gga) tg += t0 * a;
         if (gga) th += t0 * (a * a);
       }
 
-      vec_type3 vxxy, vyzz;
-      if (gga) { vxxy = vec_type3(v.x(), v.x(), v.y()); vyzz = vec_type3(v.y(), v.z(), v.z()); }
+      vec_type3 vxxy(v.x(), v.x(), v.y()), vyzz(v.y(), v.z(), v.z());
 
       // compute s, p, d
       if (i < s_functions) {
@@ -81,6 +170,66 @@ void PointGroup<scalar_type>::compute_functions(bool forces, bool gga)
 
         ii += 3;
       }
+      else if (fortran_vars.d_components == 5) {
+        // cartesian components (xx, xy, yy, xz, yz, zz), all normalized as xy, combined into xy, yz, z2, xz, x2-y2
+        scalar_type fc[6];
+        fc[0] = t * v.x() * v.x();
+        fc[1] = t * v.y() * v.x();
+        fc[2] = t * v.y() * v.y();
+        fc[3] = t * v.z() * v.x();
+        fc[4] = t * v.z() * v.y();
+        fc[5] = t * v.z() * v.z();
+
+        function_values(ii + 0, point) = fc[1];
+        function_values(ii + 1, point) = fc[4];
+        function_values(ii + 2, point) = (2 * fc[5] - fc[0] - fc[2]) * (scalar_type)SPHERICAL_D_Z2;
+        function_values(ii + 3, point) = fc[3];
+        function_values(ii + 4, point) = (fc[0] - fc[2]) * (scalar_type)0.5;
+
+        if (forces || gga) {
+          vec_type3 gc[6];
+          gc[0] = vec_type3(vec_type3(2 * v.x(), 0      , 0      ) * t - v * 2 * tg * v.x() * v.x());
+          gc[1] = vec_type3(vec_type3(v.y()    , v.x()  , 0      ) * t - v * 2 * tg * v.y() * v.x());
+          gc[2] = vec_type3(vec_type3(0        , 2 * v.y(), 0    ) * t - v * 2 * tg * v.y() * v.y());
+          gc[3] = vec_type3(vec_type3(v.z()    , 0      , v.x()  ) * t - v * 2 * tg * v.z() * v.x());
+          gc[4] = vec_type3(vec_type3(0        , v.z()  , v.y()  ) * t - v * 2 * tg * v.z() * v.y());
+          gc[5] = vec_type3(vec_type3(0        , 0      , 2 * v.z()) * t - v * 2 * tg * v.z() * v.z());
+
+          gradient_values(ii + 0, point) = gc[1];
+          gradient_values(ii + 1, point) = gc[4];
+          gradient_values(ii + 2, point) = vec_type3((gc[5] * 2 - gc[0] - gc[2]) * (scalar_type)SPHERICAL_D_Z2);
+          gradient_values(ii + 3, point) = gc[3];
+          gradient_values(ii + 4, point) = vec_type3((gc[0] - gc[2]) * (scalar_type)0.5);
+        }
+
+        if (gga) {
+          vec_type3 hc1[6], hc2[6];
+          hc1[0] = vec_type3((v * v)       * 4 * th * (v.x() * v.x()) - vec_type3(10, 2, 2) * tg * (v.x() * v.x()) + vec_type3(2 * t, 0, 0));
+          hc2[0] = vec_type3((vxxy * vyzz) * 4 * th * (v.x() * v.x()) - vec_type3(4,  4, 0) * tg * (vxxy * vyzz));
+          hc1[1] = vec_type3((v * v)       * 4 * th * (v.x() * v.y()) - vec_type3(6,  6, 2) * tg * (v.x() * v.y()));
+          hc2[1] = vec_type3((vxxy * vyzz) * 4 * th * (v.x() * v.y()) - vec_type3(2 * (v.x() * v.x() + v.y() * v.y()), 2 * v.y() * v.z(), 2 * v.x() * v.z()) * tg + vec_type3(t, 0, 0));
+          hc1[2] = vec_type3((v * v)       * 4 * th * (v.y() * v.y()) - vec_type3(2, 10, 2) * tg * (v.y() * v.y()) + vec_type3(0, 2 * t, 0));
+          hc2[2] = vec_type3((vxxy * vyzz) * 4 * th * (v.y() * v.y()) - vec_type3(4,  0, 4) * tg * (vxxy * vyzz));
+          hc1[3] = vec_type3((v * v)       * 4 * th * (v.x() * v.z()) - vec_type3(6,  2, 6) * tg * (v.x() * v.z()));
+          hc2[3] = vec_type3((vxxy * vyzz) * 4 * th * (v.x() * v.z()) - vec_type3(2 * v.y() * v.z(), 2 * (v.x() * v.x() + v.z() * v.z()), 2 * v.x() * v.y()) * tg + vec_type3(0, t, 0));
+          hc1[4] = vec_type3((v * v)       * 4 * th * (v.y() * v.z()) - vec_type3(2,  6, 6) * tg * (v.y() * v.z()));
+          hc2[4] = vec_type3((vxxy * vyzz) * 4 * th * (v.y() * v.z()) - vec_type3(2 * v.x() * v.z(), 2 * v.x() * v.y(), 2 * (v.y() * v.y() + v.z() * v.z())) * tg + vec_type3(0, 0, t));
+          hc1[5] = vec_type3((v * v)       * 4 * th * (v.z() * v.z()) - vec_type3(2,  2, 10) * tg * (v.z() * v.z()) + vec_type3(0, 0, 2 * t));
+          hc2[5] = vec_type3((vxxy * vyzz) * 4 * th * (v.z() * v.z()) - vec_type3(0,  4, 4) * tg * (vxxy * vyzz));
+
+          hessian_values(2 * (ii + 0) + 0, point) = hc1[1];
+          hessian_values(2 * (ii + 0) + 1, point) = hc2[1];
+          hessian_values(2 * (ii + 1) + 0, point) = hc1[4];
+          hessian_values(2 * (ii + 1) + 1, point) = hc2[4];
+          hessian_values(2 * (ii + 2) + 0, point) = vec_type3((hc1[5] * 2 - hc1[0] - hc1[2]) * (scalar_type)SPHERICAL_D_Z2);
+          hessian_values(2 * (ii + 2) + 1, point) = vec_type3((hc2[5] * 2 - hc2[0] - hc2[2]) * (scalar_type)SPHERICAL_D_Z2);
+          hessian_values(2 * (ii + 3) + 0, point) = hc1[3];
+          hessian_values(2 * (ii + 3) + 1, point) = hc2[3];
+          hessian_values(2 * (ii + 4) + 0, point) = vec_type3((hc1[0] - hc1[2]) * (scalar_type)0.5);
+          hessian_values(2 * (ii + 4) + 1, point) = vec_type3((hc2[0] - hc2[2]) * (scalar_type)0.5);
+        }
+        ii += 5;
+      }
       else {
         function_values(ii + 0, point) = t * v.x() * v.x() * fortran_vars.normalization_factor;
         function_values(ii + 1, point) = t * v.y() * v.x();
@@ -116,6 +265,103 @@ void PointGroup<scalar_type>::compute_functions(bool forces, bool gga)
       }
     }
   }
+  }
+}
+
+template<class scalar_type>
+void PointGroup<scalar_type>::compress_functions(void)
+{
+  compressed_function_values.compress(function_values);
+  function_values.deallocate();
+
+  if (gradient_values.is_allocated()) {
+    compressed_gradient_values.compress(gradient_values);
+    gradient_values.deallocate();
+  }
+  if (hessian_values.is_allocated()) {
+    compressed_hessian_values.compress(hessian_values);
+    hessian_values.deallocate();
+  }
+}
+
+template<class scalar_type>
+void PointGroup<scalar_type>::decompress_functions(void)
+{
+  compressed_function_values.decompress(function_values);
+  if (compressed_gradient_values.is_allocated()) compressed_gradient_values.decompress(gradient_values);
+  if (compressed_hessian_values.is_allocated()) compressed_hessian_values.decompress(hessian_values);
+}
+
+template<class scalar_type>
+size_t PointGroup<scalar_type>::function_table_bytes(bool forces, bool gga) const
+{
+  // rows are padded as in the (aligned) tables
+  size_t bytes = (size_t)HostMatrix<scalar_type>::aligned_pitch(total_functions()) * number_of_points * sizeof(scalar_type);
+  if (forces || gga) bytes += (size_t)HostMatrix<vec_type3>::aligned_pitch(total_functions()) * number_of_points * sizeof(vec_type3);
+  if (gga) bytes += (size_t)HostMatrix<vec_type3>::aligned_pitch(2 * total_functions()) * number_of_points * sizeof(vec_type3);
+  return bytes;
+}
+
+template<class scalar_type>
+size_t PointGroup<scalar_type>::cached_table_bytes(bool forces, bool gga) const
+{
+  if (!compressed_functions) return function_table_bytes(forces, gga);
+
+  size_t bytes = CompressedMatrix<scalar_type>::bytes((size_t)HostMatrix<scalar_type>::aligned_pitch(total_functions()) * number_of_points);
+  if (forces || gga) bytes += CompressedMatrix<scalar_type>::bytes((size_t)HostMatrix<vec_type3>::aligned_pitch(total_functions()) * number_of_points * 3);
+  if (gga) bytes += CompressedMatrix<scalar_type>::bytes((size_t)HostMatrix<vec_type3>::aligned_pitch(2 * total_functions()) * number_of_points * 3);
+  return bytes;
+}
+
+template<class scalar_type>
+void PointGroup<scalar_type>::spill_functions(size_t offset)
+{
+  char* target = spill_area.at(offset);
+  memcpy(target, function_values.data, function_values.storage_bytes());
+  target += function_values.storage_bytes();
+  function_values.deallocate();
+
+  spilled_gradients = gradient_values.is_allocated();
+  if (spilled_gradients) {
+    memcpy(target, gradient_values.data, gradient_values.storage_bytes());
+    target += gradient_values.storage_bytes();
+    gradient_values.deallocate();
+  }
+  spilled_hessians = hessian_values.is_allocated();
+  if (spilled_hessians) {
+    memcpy(target, hessian_values.data, hessian_values.storage_bytes());
+    hessian_values.deallocate();
+  }
+
+  spilled = true;
+  spill_offset = offset;
+}
+
+template<class scalar_type>
+void PointGroup<scalar_type>::restore_functions(void)
+{
+  uint group_m = total_functions();
+  const char* source = spill_area.at(spill_offset);
+
+  function_values.reshape(group_m, number_of_points);
+  memcpy(function_values.data, source, function_values.storage_bytes());
+  source += function_values.storage_bytes();
+
+  if (spilled_gradients) {
+    gradient_values.reshape(group_m, number_of_points);
+    memcpy(gradient_values.data, source, gradient_values.storage_bytes());
+    source += gradient_values.storage_bytes();
+  }
+  if (spilled_hessians) {
+    hessian_values.reshape(group_m * 2, number_of_points);
+    memcpy(hessian_values.data, source, hessian_values.storage_bytes());
+  }
+}
+
+template<class scalar_type>
+void PointGroup<scalar_type>::prefetch_functions(void) const
+{
+  if (spilled) spill_area.prefetch(spill_offset, function_table_bytes(spilled_gradients, spilled_hessians));
 }
 
 template class PointGroup<double>;
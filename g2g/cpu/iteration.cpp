@@ -10,7 +10,9 @@
 #include "../matrix.h"
 #include "../timer.h"
 #include "../partition.h"
+#include "../trace.h"
 #include "cpu_vector_types.h"
+#include "solve_buffers.h"
 
 #include "cpu/pot.h"
 
@@ -19,6 +21,39 @@ using std::endl;
 using std::vector;
 
 namespace G2G {
+/* conversion of the group tables to the precision of the kernel */
+template<class T, class S> static inline void convert_value(T& out, const S& in) { out = (T)in; }
+template<class T, class S> static inline void convert_value(vec_type<T,3>& out, const vec_type<S,3>& in) {
+  out = vec_type<T,3>(in.x(), in.y(), in.z());
+}
+
+template<class T> static const HostMatrix<T>& kernel_table(const HostMatrix<T>& table, HostMatrix<T>& converted) {
+  return table;
+}
+
+template<class T, class S> static const HostMatrix<T>& kernel_table(const HostMatrix<S>& table, HostMatrix<T>& converted) {
+  static const HostMatrix<T> empty;
+  if (!table.is_allocated()) return empty;
+  converted.reshape(table.width, table.height);
+  for (uint j = 0; j < table.height; j++)
+    for (uint i = 0; i < table.width; i++) convert_value(converted(i, j), table(i, j));
+  return converted;
+}
+
+unsigned int solve_buffers_generation = 1;
+
+template<class T> static void release_solve_buffers(void) {
+  vector<SolveBuffers<T>*>& list = solve_buffers_list<T>();
+  for (uint i = 0; i < list.size(); i++) delete list[i];
+  list.clear();
+}
+
+void release_solve_buffers(void) {
+  release_solve_buffers<float>();
+  release_solve_buffers<double>();
+  solve_buffers_generation++;
+}
+
 template<class scalar_type>
 void PointGroup<scalar_type>::solve(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,
                                     double& energy, double& energy_i, double& energy_c, double& energy_c1, double& energy_c2,
@@ -26,50 +61,128 @@ void PointGroup<scalar_type>::solve(Timers& timers, bool compute_rmm, bool lda,
   solve_closed(timers, compute_rmm, lda, compute_forces, compute_energy, energy, fort_forces_ptr);
 }
 
+/* exchanges the tables of the group that are filled on every solve with the buffers of the thread: lending them
+ * before computing, restoring or expanding the tables and taking them back after the solve reuses their storage */
+template<class scalar_type>
+static void swap_group_tables(PointGroup<scalar_type>& group, SolveBuffers<scalar_type>& buffers, bool gradients, bool hessians) {
+  group.function_values.swap(buffers.functions);
+  if (gradients) group.gradient_values.swap(buffers.gradients);
+  if (hessians) group.hessian_values.swap(buffers.hessians);
+}
+
 template<class scalar_type>
 void PointGroup<scalar_type>::solve_closed(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,
                                     double& energy, double* fort_forces_ptr)
 {
-  HostMatrix<scalar_type> rmm_output;
-  uint group_m = total_functions();
-  if (compute_rmm) { rmm_output.resize(group_m, group_m); rmm_output.zero(); }
-
   #if CPU_RECOMPUTE
+  bool lent_gradients = (compute_forces || !lda), lent_hessians = !lda;
+  swap_group_tables(*this, solve_buffers<scalar_type>(), lent_gradients, lent_hessians);
+
   /** Compute functions **/
   timers.functions.start();
+  timers.perf_functions.start();
+  trace_begin("functions");
   compute_functions(compute_forces, !lda);
+  trace_end("functions");
+  timers.perf_functions.pause();
   timers.functions.pause();
+  #else
+  /** Bring back the tables of this group from the spill area, expand the reduced precision ones or
+      compute them if they didn't fit in max_host_memory **/
+  bool lent_gradients = false, lent_hessians = false;
+  if (recompute_functions || spilled || compressed_functions) {
+    if (recompute_functions) { lent_gradients = (compute_forces || !lda); lent_hessians = !lda; }
+    else if (spilled) { lent_gradients = spilled_gradients; lent_hessians = spilled_hessians; }
+    else { lent_gradients = compressed_gradient_values.is_allocated(); lent_hessians = compressed_hessian_values.is_allocated(); }
+    swap_group_tables(*this, solve_buffers<scalar_type>(), lent_gradients, lent_hessians);
+
+    timers.functions.start();
+    timers.perf_functions.start();
+    trace_begin("functions");
+    if (recompute_functions) compute_functions(compute_forces, !lda);
+    else if (spilled) restore_functions();
+    else decompress_functions();
+    trace_end("functions");
+    timers.perf_functions.pause();
+    timers.functions.pause();
+  }
   #endif
+
+  if (kernel_precision == DOUBLE_PRECISION)
+    solve_closed_kernel<double>(timers, compute_rmm, lda, compute_forces, compute_energy, energy, fort_forces_ptr);
+  else
+    solve_closed_kernel<float>(timers, compute_rmm, lda, compute_forces, compute_energy, energy, fort_forces_ptr);
+
+#if CPU_RECOMPUTE
+  /* give back the tables */
+  swap_group_tables(*this, solve_buffers<scalar_type>(), lent_gradients, lent_hessians);
+#else
+  if (recompute_functions || spilled || compressed_functions)
+    swap_group_tables(*this, solve_buffers<scalar_type>(), lent_gradients, lent_hessians);
+#endif
+}
+
+template<class scalar_type> template<class kernel_type>
+void PointGroup<scalar_type>::solve_closed_kernel(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,
+                                    double& energy, double* fort_forces_ptr)
+{
+  typedef vec_type<kernel_type,3> kernel_vec3;
+
+  SolveBuffers<kernel_type>& buffers = solve_buffers<kernel_type>();
+
+  /* tables in the precision of this kernel (the cached ones when it matches scalar_type) */
+  timers.functions.start();
+  const HostMatrix<kernel_type>& function_values = kernel_table(this->function_values, buffers.functions);
+  const HostMatrix<kernel_vec3>& gradient_values = kernel_table(this->gradient_values, buffers.gradients);
+  const HostMatrix<kernel_vec3>& hessian_values = kernel_table(this->hessian_values, buffers.hessians);
+  timers.functions.pause();
+
+  HostMatrix<kernel_type>& rmm_output = buffers.rmm_output;
+  uint group_m = total_functions();
+  if (compute_rmm) rmm_output.reshape(group_m, group_m).zero();
+
   double localenergy = 0.0;
   // prepare rmm_input for this group
   timers.density.start();
-  HostMatrix<scalar_type> rmm_input(group_m, group_m);
-  get_rmm_input(rmm_input);
+  timers.perf_density.start();
+  trace_begin("rmm input");
+  HostMatrix<scalar_type>& group_rmm_input = solve_buffers<scalar_type>().rmm_input;
+  group_rmm_input.reshape(group_m, group_m);
+  get_rmm_input(group_rmm_input);
+  const HostMatrix<kernel_type>& rmm_input = kernel_table(group_rmm_input, buffers.rmm_input);
+  trace_end("rmm input");
   timers.density.pause();
 
-  HostMatrix<vec_type3> forces(total_nucleii(), 1); forces.zero();
-  vector<std::vector<vec_type3> > forces_mat(
-      points.size(), vector<vec_type3>(total_nucleii(), vec_type3(0.f,0.f,0.f)));
-  vector<scalar_type> factors_rmm(points.size(),0);
+  HostMatrix<kernel_vec3>& forces = buffers.forces;
+  forces.reshape(total_nucleii(), 1).zero();
+  // contribution of each point (column) to the force on each nucleus (row)
+  HostMatrix<kernel_vec3>& forces_mat = buffers.forces_mat;
+  if (compute_forces && !points.empty()) forces_mat.reshape(total_nucleii(), points.size());
+  HostMatrix<kernel_type>& factors_rmm = buffers.factors_rmm;
+  if (compute_rmm && !points.empty()) factors_rmm.reshape(points.size());
   /******** each point *******/
-  vector<Point> _points(points.begin(),points.end());
-#pragma omp parallel for reduction(+:localenergy)
-  for(int point = 0; point<_points.size(); point++)
+  // nowait: the end of each thread's share of the points marks its idle time in the trace
+#pragma omp parallel reduction(+:localenergy)
+  {
+  trace_begin("points");
+  HostMatrix<kernel_vec3>& dd = solve_buffers<kernel_type>().dd;
+  if (compute_forces) dd.reshape(total_nucleii(), 1);
+#pragma omp for nowait
+  for(int point = 0; point<points.size(); point++)
   {
-    HostMatrix<vec_type3> dd;
     /** density **/
-    scalar_type partial_density = 0;
-    vec_type3 dxyz(0,0,0);
-    vec_type3 dd1(0,0,0);
-    vec_type3 dd2(0,0,0);
+    kernel_type partial_density = 0;
+    kernel_vec3 dxyz(0,0,0);
+    kernel_vec3 dd1(0,0,0);
+    kernel_vec3 dd2(0,0,0);
 
-    timers.density.start();
+    timers.point_density.start();
     if (lda) {
       for (uint i = 0; i < group_m; i++) {
-        scalar_type w = 0.0;
-        scalar_type Fi = function_values(i, point);
+        kernel_type w = 0.0;
+        kernel_type Fi = function_values(i, point);
         for (uint j = i; j < group_m; j++) {
-          scalar_type Fj = function_values(j, point);
+          kernel_type Fj = function_values(j, point);
           w += rmm_input(j, i) * Fj;
         }
         partial_density += Fi * w;
@@ -77,26 +190,26 @@ void PointGroup<scalar_type>::solve_closed(Timers& timers, bool compute_rmm, boo
     }
     else {
       for (int i = 0; i < group_m; i++) {
-        scalar_type w = 0.0;
-        vec_type3 w3(0,0,0);
-        vec_type3 ww1(0,0,0);
-        vec_type3 ww2(0,0,0);
+        kernel_type w = 0.0;
+        kernel_vec3 w3(0,0,0);
+        kernel_vec3 ww1(0,0,0);
+        kernel_vec3 ww2(0,0,0);
 
-        scalar_type Fi = function_values(i, point);
-        vec_type3 Fgi(gradient_values(i, point));
-        vec_type3 Fhi1(hessian_values(2 * (i + 0) + 0, point));
-        vec_type3 Fhi2(hessian_values(2 * (i + 0) + 1, point));
+        kernel_type Fi = function_values(i, point);
+        kernel_vec3 Fgi(gradient_values(i, point));
+        kernel_vec3 Fhi1(hessian_values(2 * (i + 0) + 0, point));
+        kernel_vec3 Fhi2(hessian_values(2 * (i + 0) + 1, point));
 
         for (uint j = 0; j <= i; j++) {
-          scalar_type rmm = rmm_input(j,i);
-          scalar_type Fj = function_values(j, point);
+          kernel_type rmm = rmm_input(j,i);
+          kernel_type Fj = function_values(j, point);
           w += Fj * rmm;
 
-          vec_type3 Fgj(gradient_values(j, point));
+          kernel_vec3 Fgj(gradient_values(j, point));
           w3 += Fgj * rmm;
 
-          vec_type3 Fhj1(hessian_values(2 * (j + 0) + 0, point));
-          vec_type3 Fhj2(hessian_values(2 * (j + 0) + 1, point));
+          kernel_vec3 Fhj1(hessian_values(2 * (j + 0) + 0, point));
+          kernel_vec3 Fhj2(hessian_values(2 * (j + 0) + 1, point));
           ww1 += Fhj1 * rmm;
           ww2 += Fhj2 * rmm;
         }
@@ -105,27 +218,27 @@ void PointGroup<scalar_type>::solve_closed(Timers& timers, bool compute_rmm, boo
         dxyz += Fgi * w + w3 * Fi;
         dd1 += Fgi * w3 * 2 + Fhi1 * w + ww1 * Fi;
 
-        vec_type3 FgXXY(Fgi.x(), Fgi.x(), Fgi.y());
-        vec_type3 w3YZZ(w3.y(), w3.z(), w3.z());
-        vec_type3 FgiYZZ(Fgi.y(), Fgi.z(), Fgi.z());
-        vec_type3 w3XXY(w3.x(), w3.x(), w3.y());
+        kernel_vec3 FgXXY(Fgi.x(), Fgi.x(), Fgi.y());
+        kernel_vec3 w3YZZ(w3.y(), w3.z(), w3.z());
+        kernel_vec3 FgiYZZ(Fgi.y(), Fgi.z(), Fgi.z());
+        kernel_vec3 w3XXY(w3.x(), w3.x(), w3.y());
         dd2 += FgXXY * w3YZZ + FgiYZZ * w3XXY + Fhi2 * w + ww2 * Fi;
       }
 
     }
-    timers.density.pause();
-    timers.forces.start();
+    timers.point_density.pause();
+    timers.point_forces.start();
     /** density derivatives **/
     if (compute_forces) {
-      dd.resize(total_nucleii(), 1); dd.zero();
+      dd.zero();
       for (uint i = 0, ii = 0; i < total_functions_simple(); i++) {
         uint nuc = func2local_nuc(ii);
-        uint inc_i = small_function_type(i);
-        vec_type3 this_dd = vec_type3(0,0,0);
+        uint inc_i = small_function_size(i);
+        kernel_vec3 this_dd = kernel_vec3(0,0,0);
         for (uint k = 0; k < inc_i; k++, ii++) {
-          scalar_type w = 0.0;
+          kernel_type w = 0.0;
           for (uint j = 0; j < group_m; j++) {
-            scalar_type Fj = function_values(j, point);
+            kernel_type Fj = function_values(j, point);
             w += rmm_input(j, ii) * Fj * (ii == j ? 2 : 1);
           }
           this_dd -= gradient_values(ii, point) * w;
@@ -133,61 +246,70 @@ void PointGroup<scalar_type>::solve_closed(Timers& timers, bool compute_rmm, boo
         dd(nuc) += this_dd;
       }
     }
-    timers.forces.pause();
+    timers.point_forces.pause();
 
-    timers.pot.start();
+    timers.point_pot.start();
 
-    timers.density.start();
+    timers.point_density.start();
     /** energy / potential **/
-    scalar_type exc = 0, corr = 0, y2a = 0;
+    kernel_type exc = 0, corr = 0, y2a = 0;
     if (lda)
       cpu_pot(partial_density, exc, corr, y2a);
     else {
       cpu_potg(partial_density, dxyz, dd1, dd2, exc, corr, y2a);
     }
 
-    timers.pot.pause();
+    timers.point_pot.pause();
 
     if (compute_energy)
-      localenergy += (partial_density * _points[point].weight) * (exc + corr);
+      localenergy += (partial_density * points[point].weight) * (exc + corr);
 
-    timers.density.pause();
+    timers.point_density.pause();
 
     /** forces **/
-    timers.forces.start();
+    timers.point_forces.start();
     if (compute_forces) {
-      scalar_type factor = _points[point].weight * y2a;
+      kernel_type factor = points[point].weight * y2a;
       for (uint i = 0; i < total_nucleii(); i++) {
-        forces_mat[point][i] = dd(i) * factor;
+        forces_mat(i, point) = dd(i) * factor;
       }
     }
-    timers.forces.pause();
+    timers.point_forces.pause();
 
     /** RMM **/
-    timers.rmm.start();
+    timers.point_rmm.start();
     if (compute_rmm) {
-      scalar_type factor = _points[point].weight * y2a;
-      factors_rmm[point] = factor;
+      kernel_type factor = points[point].weight * y2a;
+      factors_rmm(point) = factor;
     }
-    timers.rmm.pause();
+    timers.point_rmm.pause();
   } // end for
+  trace_end("points");
+  }
+  timers.perf_density.pause();
 
   if (compute_rmm) {
-    for(int i=0; i<_points.size(); i++) {
-      scalar_type factor = factors_rmm[i];
-      HostMatrix<scalar_type>::blas_ssyr(LowerTriangle, factor, function_values, rmm_output, i);
+    timers.perf_rmm.start();
+    trace_begin("rmm");
+    for(int i=0; i<points.size(); i++) {
+      kernel_type factor = factors_rmm(i);
+      HostMatrix<kernel_type>::blas_ssyr(LowerTriangle, factor, function_values, rmm_output, i);
     }
+    trace_end("rmm");
+    timers.perf_rmm.pause();
   }
 
   timers.forces.start();
+  timers.perf_forces.start();
+  trace_begin("forces");
   /* accumulate forces for each point */
   if (compute_forces) {
-    if(forces_mat.size() > 0) {
+    if(!points.empty()) {
 #pragma omp parallel for
-      for (int j = 0; j < forces_mat[0].size(); j++) {
-        vec_type3 acum(0.f,0.f,0.f);
-        for (int i = 0; i < forces_mat.size(); i++) {
-          acum += forces_mat[i][j];
+      for (int j = 0; j < total_nucleii(); j++) {
+        kernel_vec3 acum(0.f,0.f,0.f);
+        for (int i = 0; i < points.size(); i++) {
+          acum += forces_mat(j, i);
         }
         forces(j) = acum;
       }
@@ -199,25 +321,29 @@ void PointGroup<scalar_type>::solve_closed(Timers& timers, bool compute_rmm, boo
     FortranMatrix<double> fort_forces(fort_forces_ptr, fortran_vars.atoms, 3, fortran_vars.max_atoms); // TODO: mover esto a init.cpp
     for (uint i = 0; i < total_nucleii(); i++) {
       uint global_atom = local2global_nuc[i];
-      vec_type3 this_force = forces(i);
+      kernel_vec3 this_force = forces(i);
       fort_forces(global_atom,0) += this_force.x();
       fort_forces(global_atom,1) += this_force.y();
       fort_forces(global_atom,2) += this_force.z();
     }
   }
+  trace_end("forces");
+  timers.perf_forces.pause();
   timers.forces.pause();
 
   timers.rmm.start();
+  timers.perf_rmm.start();
+  trace_begin("rmm accumulate");
   /* accumulate RMM results for this group */
   if (compute_rmm) {
     for (uint i = 0, ii = 0; i < total_functions_simple(); i++) {
-      uint inc_i = small_function_type(i);
+      uint inc_i = small_function_size(i);
 
       for (uint k = 0; k < inc_i; k++, ii++) {
         uint big_i = local2global_func[i] + k;
 
         for (uint j = 0, jj = 0; j < total_functions_simple(); j++) {
-          uint inc_j = small_function_type(j);
+          uint inc_j = small_function_size(j);
 
           for (uint l = 0; l < inc_j; l++, jj++) {
             uint big_j = local2global_func[j] + l;
@@ -230,15 +356,10 @@ void PointGroup<scalar_type>::solve_closed(Timers& timers, bool compute_rmm, boo
       }
     }
   }
+  trace_end("rmm accumulate");
+  timers.perf_rmm.pause();
   timers.rmm.pause();
   energy+=localenergy;
-
-#if CPU_RECOMPUTE
-  /* clear functions */
-  function_values.deallocate();
-  gradient_values.deallocate();
-  hessian_values.deallocate();
-#endif
 }
 
 template class PointGroup<double>;
@@ -0,0 +1,57 @@
+#ifndef __G2G_SOLVE_BUFFERS_H__
+#define __G2G_SOLVE_BUFFERS_H__
+
+#include <vector>
+#include "../matrix.h"
+
+namespace G2G {
+  /**
+   * Temporaries of the solve (CPU only), kept between groups and iterations
+   * so that once they reach the size of the largest group the solves don't
+   * allocate. Each thread has its own set (the point loops use them too)
+   * and they grow through reshape.
+   *
+   * functions, gradients and hessians hold the tables converted to the
+   * precision of the kernel. When the kernel runs in the precision of the
+   * group they are lent to the group instead, for the tables it computes,
+   * restores or expands on every solve.
+   */
+  template<class T> struct SolveBuffers {
+    HostMatrix<T> functions, rmm_input, rmm_output, factors_rmm;
+    HostMatrix<vec_type<T,3> > gradients, hessians, forces, forces_mat, dd;
+    std::vector<T> primitive_values; // exponentials of compute_functions
+
+    SolveBuffers(void) {
+      functions.set_category(MEMORY_FUNCTIONS);
+      gradients.set_category(MEMORY_DERIVATIVES); hessians.set_category(MEMORY_DERIVATIVES);
+      rmm_input.set_category(MEMORY_RMM); rmm_output.set_category(MEMORY_RMM); factors_rmm.set_category(MEMORY_RMM);
+      forces.set_category(MEMORY_FORCES); forces_mat.set_category(MEMORY_FORCES); dd.set_category(MEMORY_FORCES);
+      // aligned rows as the group tables, for the point loop and syr
+      functions.set_aligned(true); gradients.set_aligned(true); hessians.set_aligned(true);
+      rmm_input.set_aligned(true); rmm_output.set_aligned(true);
+    }
+  };
+
+  extern unsigned int solve_buffers_generation; // release_solve_buffers moves to the next one, so threads allocate them again
+
+  template<class T> std::vector<SolveBuffers<T>*>& solve_buffers_list(void) {
+    static std::vector<SolveBuffers<T>*> list;
+    return list;
+  }
+
+  /* the buffers of the calling thread */
+  template<class T> SolveBuffers<T>& solve_buffers(void) {
+    static SolveBuffers<T>* buffers = NULL;
+    static unsigned int generation = 0;
+    #pragma omp threadprivate(buffers, generation)
+    if (generation != solve_buffers_generation) {
+      buffers = new SolveBuffers<T>();
+      generation = solve_buffers_generation;
+      #pragma omp critical(solve_buffers)
+      solve_buffers_list<T>().push_back(buffers);
+    }
+    return *buffers;
+  }
+}
+
+#endif
@@ -0,0 +1,57 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <cstdlib>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include "../common.h"
+#include "../init.h"
+#include "spill_area.h"
+using namespace std;
+
+namespace G2G {
+SpillArea spill_area;
+
+SpillArea::SpillArea(void) : fd(-1), base(NULL), length(0) { }
+
+SpillArea::~SpillArea(void) {
+  clear();
+}
+
+void SpillArea::reserve(size_t bytes) {
+  clear();
+  if (bytes == 0) return;
+
+  string path = spill_directory + "/g2g_spill_XXXXXX";
+  vector<char> name(path.begin(), path.end());
+  name.push_back('\0');
+
+  fd = mkstemp(&name[0]);
+  if (fd < 0) throw runtime_error(string("Could not create spill file in ") + spill_directory);
+  unlink(&name[0]);
+
+  if (ftruncate(fd, bytes) != 0) { clear(); throw runtime_error("Could not resize spill file"); }
+
+  void* p = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) { clear(); throw runtime_error("Could not map spill file"); }
+  base = (char*)p;
+  length = bytes;
+
+  cout << "spill area: " << (bytes >> 20) << " MB in " << spill_directory << endl;
+}
+
+void SpillArea::clear(void) {
+  if (base) munmap(base, length);
+  if (fd >= 0) close(fd);
+  base = NULL; fd = -1; length = 0;
+}
+
+void SpillArea::prefetch(size_t offset, size_t bytes) const {
+  if (!base || bytes == 0) return;
+  size_t page = sysconf(_SC_PAGESIZE);
+  size_t start = offset - (offset % page);
+  madvise(base + start, bytes + (offset - start), MADV_WILLNEED);
+}
+}
@@ -0,0 +1,35 @@
+#ifndef __G2G_SPILL_AREA_H__
+#define __G2G_SPILL_AREA_H__
+
+#include <cstddef>
+
+namespace G2G {
+  /**
+   * Memory mapped scratch file holding the function tables of every group
+   * (CPU only). The file lives in spill_directory and is unlinked as soon
+   * as it is created, so it goes away together with the process.
+   */
+  class SpillArea {
+    public:
+      SpillArea(void);
+      ~SpillArea(void);
+
+      void reserve(size_t bytes);
+      void clear(void);
+
+      inline bool is_mapped(void) const { return base != NULL; }
+      inline char* at(size_t offset) { return base + offset; }
+
+      /* asks the kernel to start reading this range in the background */
+      void prefetch(size_t offset, size_t bytes) const;
+
+    private:
+      int fd;
+      char* base;
+      size_t length;
+  };
+
+  extern SpillArea spill_area;
+}
+
+#endif
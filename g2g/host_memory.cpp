@@ -0,0 +1,71 @@
+#include <iostream>
+#include <iomanip>
+#include "common.h"
+#include "init.h"
+#include "host_memory.h"
+using namespace std;
+
+namespace G2G {
+
+size_t HostMemory::current_bytes[MEMORY_CATEGORIES];
+size_t HostMemory::peak_bytes[MEMORY_CATEGORIES];
+size_t HostMemory::current_total = 0;
+size_t HostMemory::peak_total = 0;
+
+static const char* memory_category_names[MEMORY_CATEGORIES] = {
+  "other", "functions", "gradients/hessians", "points", "rmm", "forces"
+};
+
+/* allocations happen inside OpenMP loops too: counters are updated atomically, without locks */
+static void raise_peak(size_t* peak, size_t value) {
+  size_t old_peak = *peak;
+  while (value > old_peak) {
+    size_t seen = __sync_val_compare_and_swap(peak, old_peak, value);
+    if (seen == old_peak) break;
+    old_peak = seen;
+  }
+}
+
+void HostMemory::allocated(MemoryCategory category, size_t bytes) {
+  raise_peak(&peak_bytes[category], __sync_add_and_fetch(&current_bytes[category], bytes));
+  raise_peak(&peak_total, __sync_add_and_fetch(&current_total, bytes));
+}
+
+void HostMemory::released(MemoryCategory category, size_t bytes) {
+  __sync_sub_and_fetch(&current_bytes[category], bytes);
+  __sync_sub_and_fetch(&current_total, bytes);
+}
+
+size_t HostMemory::current(MemoryCategory category) {
+  return current_bytes[category];
+}
+
+size_t HostMemory::peak(MemoryCategory category) {
+  return peak_bytes[category];
+}
+
+size_t HostMemory::total(void) {
+  return current_total;
+}
+
+bool HostMemory::fits(size_t bytes) {
+  if (max_host_memory <= 0) return true;
+  return current_total + bytes <= (size_t)(max_host_memory * 1024 * 1024);
+}
+
+void HostMemory::report(const char* when) {
+  if (memory_report) {
+    const double MB = 1024.0 * 1024.0;
+    cout << "host memory [" << when << "] (MB, current/peak):" << fixed << setprecision(1);
+    for (uint i = 0; i < MEMORY_CATEGORIES; i++)
+      cout << " " << memory_category_names[i] << " " << current_bytes[i] / MB << "/" << peak_bytes[i] / MB;
+    cout << " | total " << current_total / MB << "/" << peak_total / MB << endl;
+    cout.unsetf(ios::floatfield);
+    cout << setprecision(6);
+  }
+
+  for (uint i = 0; i < MEMORY_CATEGORIES; i++) peak_bytes[i] = current_bytes[i];
+  peak_total = current_total;
+}
+
+}
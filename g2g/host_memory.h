@@ -0,0 +1,37 @@
+#ifndef __G2G_HOST_MEMORY_H__
+#define __G2G_HOST_MEMORY_H__
+
+#include <cstddef>
+
+namespace G2G {
+  enum MemoryCategory {
+    MEMORY_OTHER, MEMORY_FUNCTIONS, MEMORY_DERIVATIVES, MEMORY_POINTS, MEMORY_RMM, MEMORY_FORCES, MEMORY_CATEGORIES
+  };
+
+  /**
+   * Accounting of the host memory used by g2g: HostMatrix allocations (by the category of the matrix)
+   * and the partition storage, with the current and peak bytes of each category. The peaks are reset by
+   * each report, so every report gives the peak since the previous one. max_host_memory caps the function
+   * tables: a group whose tables don't fit recomputes its functions on every solve instead.
+   */
+  class HostMemory {
+    public:
+      static void allocated(MemoryCategory category, size_t bytes);
+      static void released(MemoryCategory category, size_t bytes);
+
+      static size_t current(MemoryCategory category);
+      static size_t peak(MemoryCategory category);
+      static size_t total(void);
+
+      static bool fits(size_t bytes); // whether allocating bytes more keeps the total under max_host_memory
+
+      static void report(const char* when); // prints and resets the peaks, if memory_report is set
+
+    private:
+      static size_t current_bytes[MEMORY_CATEGORIES];
+      static size_t peak_bytes[MEMORY_CATEGORIES];
+      static size_t current_total, peak_total;
+  };
+}
+
+#endif
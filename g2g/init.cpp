@@ -1,6 +1,8 @@
 /* headers */
 #include <iostream>
 #include <fstream>
+#include <limits>
+#include <vector>
 #include <stdexcept>
 #include <fenv.h>
 #include <signal.h>
@@ -10,6 +12,10 @@
 #include "timer.h"
 #include "partition.h"
 #include "matrix.h"
+#include "symmetry.h"
+#include "capture.h"
+#include "trace.h"
+#include "perf_counters.h"
 using std::cout;
 using std::endl;
 using std::boolalpha;
@@ -23,12 +29,25 @@ template<bool, bool> void compute_functions(void);
 
 /* internal function prototypes */
 void read_options(void);
+namespace G2G {
+void autotune_grid(void);
+}
 
 /* global variables */
 namespace G2G {
 	FortranVars fortran_vars;
+#if FULL_DOUBLE
+	KernelPrecision kernel_precision = DOUBLE_PRECISION;
+#else
+	KernelPrecision kernel_precision = SINGLE_PRECISION;
+#endif
 }
 
+/* last density change reported by the SCF (reset with every new geometry) */
+static double scf_convergence = std::numeric_limits<double>::max();
+/* grid asked for by the SCF, used once auto_grid decides to refine */
+static unsigned int scf_grid_type = 0;
+
 /* methods */
 //===========================================================================================
 extern "C" void g2g_init_(void)
@@ -60,9 +79,11 @@ extern "C" void g2g_parameter_init_(const unsigned int& norm, const unsigned int
                                     const unsigned int& M, unsigned int* ncont, const unsigned int* nshell, double* c, double* a,
                                     double* RMM, const unsigned int& M18, const unsigned int& M5, const unsigned int& M3, double* rhoalpha, double* rhobeta,
                                     const unsigned int& nco, bool& OPEN, const unsigned int& nunp, const unsigned int& nopt, const unsigned int& Iexch,
-                                    double* e, double* e2, double* e3, double* wang, double* wang2, double* wang3)
+                                    const double& told, double* e, double* e2, double* e3, double* wang, double* wang2, double* wang3)
 {
 	printf("<======= GPU Code Initialization ========>\n");
+	read_options();
+
 	fortran_vars.atoms = natom;
         fortran_vars.max_atoms = max_atoms;
         fortran_vars.gaussians = ngaussians;
@@ -83,9 +104,26 @@ extern "C" void g2g_parameter_init_(const unsigned int& norm, const unsigned int
   feenableexcept(FE_INVALID);
   #endif
 
+	// d shells come either as 6 cartesian or 5 spherical components
+	fortran_vars.d_components = (spherical_d_functions ? 5 : 6);
+  #if !CPU_KERNELS
+  if (spherical_d_functions) throw runtime_error("spherical_d_functions is only supported by the CPU kernels");
+  #endif
+  // the double kernels only reach double accuracy from tables computed in double
+  #if !CPU_KERNELS || !FULL_DOUBLE
+  if (adaptive_precision) throw runtime_error("adaptive_precision needs the CPU kernels built with full_double=1");
+  #endif
+  // only the tables cached between solves are compressed, and they are only cached without cpu_recompute
+  #if !CPU_KERNELS || CPU_RECOMPUTE
+  if (compressed_functions) throw runtime_error("compressed_functions needs the CPU kernels built with cpu_recompute=0");
+  #endif
+  // the SCF would stop (good < told) before the density change gets below the threshold, so the grid never refines
+  if (auto_grid && told > 0 && auto_grid_threshold <= told)
+    throw runtime_error("auto_grid_threshold must be above the SCF convergence criterion (told)");
+
 	fortran_vars.s_funcs = nshell[0];
 	fortran_vars.p_funcs = nshell[1] / 3;
-	fortran_vars.d_funcs = nshell[2] / 6;
+	fortran_vars.d_funcs = nshell[2] / fortran_vars.d_components;
         cout << "s: " << fortran_vars.s_funcs  << " p: " << fortran_vars.p_funcs << " d: " << fortran_vars.d_funcs << endl;
 	fortran_vars.spd_funcs = fortran_vars.s_funcs + fortran_vars.p_funcs + fortran_vars.d_funcs;
 // M =	# of contractions
@@ -120,6 +158,19 @@ extern "C" void g2g_parameter_init_(const unsigned int& norm, const unsigned int
 	fortran_vars.a_values = FortranMatrix<double>(a, fortran_vars.m, MAX_CONTRACTIONS, ngaussians);
 	fortran_vars.c_values = FortranMatrix<double>(c, fortran_vars.m, MAX_CONTRACTIONS, ngaussians);
 
+	// every d shell must come as d_components functions of the same nucleus and exponents (lioamber sends 6 cartesian components)
+	bool d_shells_ok = (nshell[2] % fortran_vars.d_components == 0 && nshell[0] + nshell[1] + nshell[2] == fortran_vars.m);
+	for (uint func = nshell[0] + nshell[1]; d_shells_ok && func < fortran_vars.m; func += fortran_vars.d_components) {
+		for (uint comp = 1; d_shells_ok && comp < fortran_vars.d_components; comp++) {
+			d_shells_ok = (fortran_vars.nucleii(func + comp) == fortran_vars.nucleii(func) && fortran_vars.contractions(func + comp) == fortran_vars.contractions(func));
+			for (uint k = 0; d_shells_ok && k < fortran_vars.contractions(func); k++)
+				d_shells_ok = (fortran_vars.a_values(func + comp, k) == fortran_vars.a_values(func, k));
+		}
+	}
+	if (!d_shells_ok)
+		throw runtime_error(spherical_d_functions ? "The d shells do not have 5 components: lioamber only builds cartesian d shells, spherical_d_functions is for replay and microbench"
+		                                          : "The d shells do not have 6 cartesian components");
+
 // nco = number of Molecular orbitals ocupped
 	fortran_vars.nco = nco;
 
@@ -163,12 +214,19 @@ extern "C" void g2g_parameter_init_(const unsigned int& norm, const unsigned int
   G2G::gpu_set_variables();
 #endif
 
-	read_options();
+  capture_parameters();
+  trace_open();
 }
 //============================================================================================================
 extern "C" void g2g_deinit_(void) {
   cout << "<====== Deinitializing G2G ======>" << endl;
+  print_fortran_timers();
+  trace_close();
+  perf_counters_close();
   partition.clear();
+#if CPU_KERNELS
+  release_solve_buffers();
+#endif
 }
 //============================================================================================================
 void compute_new_grid(const unsigned int grid_type) {
@@ -193,9 +251,17 @@ void compute_new_grid(const unsigned int grid_type) {
 
   	Timer t_grilla;
   	t_grilla.start_and_sync();
+  	PerfCounters regenerate_counters;
+  	regenerate_counters.start();
+  	trace_begin("regenerate");
   	partition.regenerate();
+  	trace_end("regenerate");
+  	regenerate_counters.pause();
   	t_grilla.stop_and_sync();
-  	//cout << "timer grilla: " << t_grilla << endl;
+  	if (!regenerate_counters.empty()) cout << "regenerate: " << regenerate_counters << endl;
+#ifdef TIMINGS
+  	cout << "timer grilla: " << t_grilla << endl;
+#endif
 
 #if CPU_KERNELS && !CPU_RECOMPUTE
   	/** compute functions **/
@@ -203,12 +269,16 @@ void compute_new_grid(const unsigned int grid_type) {
   	//else cout << "<===== computing all functions =======>" << endl;
 
 
+  	trace_begin("compute functions");
   	partition.compute_functions(fortran_vars.do_forces, fortran_vars.gga);
+  	trace_end("compute functions");
 
 #endif
+  	HostMemory::report("grid");
 }
 //==============================================================================================================
 extern "C" void g2g_reload_atom_positions_(const unsigned int& grid_type) {
+	scf_convergence = std::numeric_limits<double>::max();
 //	cout  << "<======= GPU Reload Atom Positions (" << grid_type << ")========>" << endl;
 
 	HostMatrixFloat3 atom_positions(fortran_vars.atoms);	// gpu version (float3)
@@ -227,10 +297,16 @@ extern "C" void g2g_reload_atom_positions_(const unsigned int& grid_type) {
   	G2G::gpu_set_atom_positions(atom_positions);
 #endif
 #endif
-	compute_new_grid(grid_type);
+	capture_positions(grid_type);
+
+	// with auto_grid the first iterations run on the small grid
+	scf_grid_type = grid_type;
+	if (auto_grid) compute_new_grid(SMALL_GRID);
+	else compute_new_grid(grid_type);
 }
 //==============================================================================================================
 extern "C" void g2g_new_grid_(const unsigned int& grid_type) {
+	capture_new_grid(grid_type);
 //	cout << "<======= GPU New Grid (" << grid_type << ")========>" << endl;
 	if (grid_type == (uint)fortran_vars.grid_type)
                                                              ;
@@ -243,11 +319,32 @@ template<bool compute_rmm, bool lda, bool compute_forces> void g2g_iteration(boo
 {
   Timers timers;
   timers.total.start();
+  trace_begin("XC iteration");
+
+  // the partition only holds the symmetry unique points: keep the previous values to average the XC contribution over the group
+  FortranMatrix<double> fort_forces;
+  std::vector<double> rmm_before, rmm_a_before, rmm_b_before, forces_before;
+  if (symmetry.order() > 1) {
+    if (compute_rmm && fortran_vars.OPEN) { symmetry.save(fortran_vars.rmm_output_a, rmm_a_before); symmetry.save(fortran_vars.rmm_output_b, rmm_b_before); }
+    else if (compute_rmm) symmetry.save(fortran_vars.rmm_output, rmm_before);
+    if (compute_forces) {
+      fort_forces = FortranMatrix<double>(fort_forces_ptr, fortran_vars.atoms, 3, fortran_vars.max_atoms);
+      symmetry.save(fort_forces, forces_before);
+    }
+  }
 
   partition.solve(timers, compute_rmm, lda, compute_forces, compute_energy, fort_energy_ptr, fort_forces_ptr, fortran_vars.OPEN);
 
+  if (symmetry.order() > 1) {
+    if (compute_rmm && fortran_vars.OPEN) { symmetry.symmetrize_matrix(fortran_vars.rmm_output_a, rmm_a_before); symmetry.symmetrize_matrix(fortran_vars.rmm_output_b, rmm_b_before); }
+    else if (compute_rmm) symmetry.symmetrize_matrix(fortran_vars.rmm_output, rmm_before);
+    if (compute_forces) symmetry.symmetrize_forces(fort_forces, forces_before);
+  }
+
+  trace_end("XC iteration");
   timers.total.stop();
   cout << timers << endl;
+  HostMemory::report("iteration");
 }
 
 //===============================================================================================================
@@ -273,6 +370,21 @@ extern "C" void g2g_solve_groups_(const uint& computation_type, double* fort_ene
 
   if (energy_all_iterations) compute_energy = true;
 
+  // tune the grid options once, with the first density
+  static bool autotuned = false;
+  if (autotune_tolerance > 0 && !autotuned) {
+    autotune_grid();
+    autotuned = true;
+  }
+
+  // run the kernels in single precision while far from convergence
+  if (adaptive_precision) {
+    bool far = (compute_rmm && !compute_forces && scf_convergence > adaptive_precision_threshold);
+    KernelPrecision precision = (far ? SINGLE_PRECISION : DOUBLE_PRECISION);
+    if (precision != kernel_precision) cout << "kernel precision: " << (precision == DOUBLE_PRECISION ? "double" : "single") << endl;
+    kernel_precision = precision;
+  }
+
   if (compute_rmm) {
     if (fortran_vars.lda) {
       if (compute_forces) g2g_iteration<true, true, true>(compute_energy, fort_energy_ptr, fort_forces_ptr);
@@ -297,6 +409,22 @@ extern "C" void g2g_solve_groups_(const uint& computation_type, double* fort_ene
     }
   }
   if (compute_energy) cout << "XC energy: " << *fort_energy_ptr << endl;
+
+  capture_solve(computation_type, *fort_energy_ptr);
+}
+//================================================================================================================
+/* density change of the last SCF iteration. When auto_grid moves to the SCF grid, good is raised so that the SCF
+ * doesn't stop on this iteration: the density converges again on the new grid before the final energy */
+extern "C" void g2g_scf_convergence_(double& good)
+{
+  capture_convergence(good);
+  scf_convergence = good;
+
+  if (auto_grid && (uint)fortran_vars.grid_type != scf_grid_type && good < auto_grid_threshold) {
+    cout << "auto_grid: moving to grid " << scf_grid_type << endl;
+    compute_new_grid(scf_grid_type);
+    good = std::numeric_limits<double>::max();
+  }
 }
 //================================================================================================================
 /* general options */
@@ -304,13 +432,37 @@ namespace G2G {
 	uint max_function_exponent = 10;
 	double little_cube_size = 8.0;
 	uint min_points_per_cube = 1;
+	bool point_clustering = false;
+	uint cluster_target_points = 256;
+	uint cube_merge_points = 0;
+	double cube_merge_overlap = 0.8;
 	double becke_cutoff = 1e-7;
+	double cull_points_tolerance = 0;
+	double cull_density_bound = 2.0;
   	bool assign_all_functions = false;
   	double sphere_radius = 0.6;
+  	uint sphere_radial_slabs = 1;
+  	uint sphere_angular_sectors = 1;
   	bool remove_zero_weights = true;
   	bool energy_all_iterations = false;
   	double big_function_cutoff = 1;
   	double free_global_memory = 0.0;
+  	bool spherical_d_functions = false;
+  	bool use_symmetry = false;
+  	bool compressed_functions = false;
+  	bool screen_primitives = false;
+  	std::string spill_directory;
+  	std::string partition_report;
+  	std::string capture_file;
+  	std::string trace_file;
+  	bool perf_counters = false;
+  	bool memory_report = false;
+  	double max_host_memory = 0;
+  	bool adaptive_precision = false;
+  	double adaptive_precision_threshold = 1e-4;
+  	bool auto_grid = false;
+  	double autotune_tolerance = 0;
+  	double auto_grid_threshold = 1e-3;
 }
 //=================================================================================================================
 void read_options(void) {
@@ -328,12 +480,31 @@ void read_options(void) {
 			{ f >> little_cube_size; cout << little_cube_size; }
 		else if (option == "min_points_per_cube")
 			{ f >> min_points_per_cube; cout << min_points_per_cube; }
+		else if (option == "point_clustering")
+			{ f >> point_clustering; cout << point_clustering; }
+		else if (option == "cluster_target_points")
+			{ f >> cluster_target_points; cout << cluster_target_points; }
+		else if (option == "cube_merge_points")
+			{ f >> cube_merge_points; cout << cube_merge_points; }
+		else if (option == "cube_merge_overlap")
+			{ f >> cube_merge_overlap; cout << cube_merge_overlap; }
 		else if (option == "becke_cutoff")
 			{ f >> becke_cutoff; cout << becke_cutoff; }
+		else if (option == "cull_points_tolerance")
+			{ f >> cull_points_tolerance; cout << cull_points_tolerance; }
+		else if (option == "cull_density_bound")
+			{ f >> cull_density_bound; cout << cull_density_bound; }
     		else if (option == "assign_all_functions")
       			{ f >> assign_all_functions; cout << assign_all_functions; }
     		else if (option == "sphere_radius")
       			{ f >> sphere_radius; cout << sphere_radius; }
+    		else if (option == "sphere_radial_slabs")
+      			{ f >> sphere_radial_slabs; cout << sphere_radial_slabs; }
+    		else if (option == "sphere_angular_sectors") {
+      			f >> sphere_angular_sectors; cout << sphere_angular_sectors;
+      			if (sphere_angular_sectors != 1 && sphere_angular_sectors != 2 && sphere_angular_sectors != 4 && sphere_angular_sectors != 8)
+        			throw runtime_error("sphere_angular_sectors must be 1, 2, 4 or 8");
+    		}
     		else if (option == "remove_zero_weights")
       			{ f >> remove_zero_weights; cout << remove_zero_weights; }
     		else if (option == "energy_all_iterations")
@@ -342,6 +513,38 @@ void read_options(void) {
       			{ f >> big_function_cutoff; cout << big_function_cutoff; }
                else if (option == "free_global_memory")
                    	{ f >> free_global_memory; cout << free_global_memory; }
+    		else if (option == "spherical_d_functions")
+      			{ f >> spherical_d_functions; cout << spherical_d_functions; }
+    		else if (option == "use_symmetry")
+      			{ f >> use_symmetry; cout << use_symmetry; }
+    		else if (option == "compressed_functions")
+      			{ f >> compressed_functions; cout << compressed_functions; }
+    		else if (option == "screen_primitives")
+      			{ f >> screen_primitives; cout << screen_primitives; }
+    		else if (option == "spill_directory")
+      			{ f >> spill_directory; cout << spill_directory; }
+    		else if (option == "capture_file")
+      			{ f >> capture_file; cout << capture_file; }
+    		else if (option == "partition_report")
+      			{ f >> partition_report; cout << partition_report; }
+    		else if (option == "trace_file")
+      			{ f >> trace_file; cout << trace_file; }
+    		else if (option == "perf_counters")
+      			{ f >> perf_counters; cout << perf_counters; }
+    		else if (option == "memory_report")
+      			{ f >> memory_report; cout << memory_report; }
+    		else if (option == "max_host_memory")
+      			{ f >> max_host_memory; cout << max_host_memory; }
+    		else if (option == "adaptive_precision")
+      			{ f >> adaptive_precision; cout << adaptive_precision; }
+    		else if (option == "adaptive_precision_threshold")
+      			{ f >> adaptive_precision_threshold; cout << adaptive_precision_threshold; }
+    		else if (option == "autotune_tolerance")
+      			{ f >> autotune_tolerance; cout << autotune_tolerance; }
+    		else if (option == "auto_grid")
+      			{ f >> auto_grid; cout << auto_grid; }
+    		else if (option == "auto_grid_threshold")
+      			{ f >> auto_grid_threshold; cout << auto_grid_threshold; }
 
 		else throw runtime_error(string("Invalid option: ") + option);
 
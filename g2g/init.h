@@ -1,6 +1,7 @@
 #ifndef __INIT_H__
 #define __INIT_H__
 
+#include <string>
 #include "matrix.h"
 
 namespace G2G {
@@ -13,6 +14,10 @@ namespace G2G {
     SMALL_GRID_SIZE = 50, MEDIUM_GRID_SIZE = 116, BIG_GRID_SIZE = 194
   };
 
+  enum KernelPrecision {
+    SINGLE_PRECISION, DOUBLE_PRECISION
+  };
+
   struct FortranVars {
     uint atoms, max_atoms, gaussians;
     bool normalize;
@@ -22,6 +27,7 @@ namespace G2G {
     float normalization_factor;
 #endif
     uint s_funcs, p_funcs, d_funcs, spd_funcs, m;
+    uint d_components; // 6 cartesian or 5 spherical
     uint nco;
     bool OPEN;
     uint nunp;
@@ -48,13 +54,38 @@ namespace G2G {
   extern uint max_function_exponent;
   extern double little_cube_size; // largo de una arista de los cubos chiquitos [Angstrom]
   extern uint min_points_per_cube;
+  extern bool point_clustering; // group the points outside the spheres by recursive bisection instead of cubes
+  extern uint cluster_target_points; // maximum number of points of each cluster
+  extern uint cube_merge_points; // target size of merged batches of small cubes (0: no merging)
+  extern double cube_merge_overlap; // minimum overlap (shared / total functions) of merged cubes
   extern double becke_cutoff;
+  extern double cull_points_tolerance; // points whose bounded density contribution is below this are dropped (0: no culling)
+  extern double cull_density_bound; // bound on the density matrix elements used for culling
   extern bool assign_all_functions;
   extern double sphere_radius; // between 0 and 1!
+  extern uint sphere_radial_slabs; // groups of consecutive shells each sphere is split into
+  extern uint sphere_angular_sectors; // 1, 2, 4 or 8 (octants) angular sectors each sphere is split into
   extern bool remove_zero_weights;
   extern bool energy_all_iterations;
   extern double big_function_cutoff;
   extern double free_global_memory;
+  extern bool spherical_d_functions; // 5 component d shells (CPU), only for replay and microbench: lioamber sends 6 cartesian ones
+  extern bool use_symmetry; // integrate only the symmetry unique points (reflections through the coordinate planes)
+  extern bool compressed_functions; // 16 bit cached function tables (needs cpu_recompute=0): each group expands them before its solve, so it saves memory, not bandwidth
+  extern bool screen_primitives; // skip the exponentials of primitives that are negligible at each point (CPU)
+  extern std::string spill_directory;
+  extern std::string capture_file; // file where the inputs of the run are captured for tools/replay, empty: none
+  extern std::string partition_report; // JSON (or CSV if it ends in .csv) report of each partition, empty: none
+  extern std::string trace_file; // Chrome trace-event timeline of the run, empty: none
+  extern bool perf_counters; // report hardware counters (perf_event_open) of each phase
+  extern bool memory_report; // print the host memory of each category after each grid and iteration
+  extern double max_host_memory; // MB for the cached function tables and the rest of the host memory (0: no limit)
+  extern bool adaptive_precision; // single precision CPU kernels far from convergence (needs full_double=1, applies to open shell too)
+  extern double adaptive_precision_threshold;
+  extern double autotune_tolerance; // maximum XC energy error of the tuned grid options (0: no autotuning)
+  extern bool auto_grid;
+  extern double auto_grid_threshold; // must be above the SCF convergence criterion (told)
+  extern KernelPrecision kernel_precision; // precision used by the CPU kernels in the current iteration
 }
 
 #endif
@@ -1,6 +1,9 @@
 #include <iostream>
 #include <stdexcept>
+#include <algorithm>
 #include <cstring>
+#include <cstdlib>
+#include <new>
 #include "common.h"
 #include "matrix.h"
 #include "mkl.h"
@@ -32,10 +35,24 @@ template<class T> bool Matrix<T>::is_allocated(void) const {
 /***************************
  * HostMatrix
  ***************************/
+template<class T> unsigned int HostMatrix<T>::aligned_pitch(unsigned int width) {
+  // rows must be a whole number of cache lines: a multiple of this many elements
+  unsigned int unit = 1;
+  while ((unit * sizeof(T)) % HOST_ALIGNMENT != 0) unit++;
+  return ((width + unit - 1) / unit) * unit;
+}
+
 template<class T> void HostMatrix<T>::alloc_data(void) {
   assert(this->bytes() != 0);
+  this->pitch = (aligned ? aligned_pitch(this->width) : this->width);
 
-	if (pinned) {
+	if (aligned) {
+    void* memory;
+    if (posix_memalign(&memory, HOST_ALIGNMENT, storage_bytes()) != 0) throw std::bad_alloc();
+    memset(memory, 0, storage_bytes());
+    this->data = (T*)memory;
+  }
+	else if (pinned) {
     #if !CPU_KERNELS
 		cudaError_t error_status = cudaMallocHost((void**)&this->data, this->bytes());
 		assert(error_status != cudaErrorMemoryAllocation);
@@ -46,10 +63,15 @@ template<class T> void HostMatrix<T>::alloc_data(void) {
 	else this->data = new T[this->elements()];
 
 	assert(this->data);
+	capacity = storage_elements();
+	HostMemory::allocated(category, capacity * sizeof(T));
 }
 
 template<class T> void HostMatrix<T>::dealloc_data(void) {
-	if (pinned) {
+	if (this->data) HostMemory::released(category, capacity * sizeof(T));
+	capacity = 0;
+	if (aligned) free(this->data);
+	else if (pinned) {
     #if !CPU_KERNELS
     cudaFreeHost(this->data);
     #else
@@ -62,26 +84,62 @@ template<class T> void HostMatrix<T>::dealloc_data(void) {
 template<class T> void HostMatrix<T>::deallocate(void) {
 	dealloc_data();
 	this->data = NULL;
-  this->width = this->height = 0;
+  this->width = this->height = this->pitch = 0;
 }
 
-template<class T> HostMatrix<T>::HostMatrix(PinnedFlag _pinned) : Matrix<T>() {
+template<class T> HostMatrix<T>::HostMatrix(PinnedFlag _pinned) : Matrix<T>(), pitch(0), category(MEMORY_OTHER), aligned(false), capacity(0) {
   pinned = (_pinned == Pinned);
 }
 
-template<class T> HostMatrix<T>::HostMatrix(unsigned int _width, unsigned _height, PinnedFlag _pinned) : Matrix<T>() {
+template<class T> HostMatrix<T>::HostMatrix(unsigned int _width, unsigned _height, PinnedFlag _pinned) : Matrix<T>(), pitch(0), category(MEMORY_OTHER), aligned(false), capacity(0) {
   pinned = (_pinned == Pinned);
   resize(_width, _height);
 }
 
-template<class T> HostMatrix<T>::HostMatrix(const CudaMatrix<T>& c) : Matrix<T>(), pinned(false) {
+template<class T> HostMatrix<T>::HostMatrix(const CudaMatrix<T>& c) : Matrix<T>(), pitch(0), pinned(false), category(MEMORY_OTHER), aligned(false), capacity(0) {
 	*this = c;
 }
 
-template<class T> HostMatrix<T>::HostMatrix(const HostMatrix<T>& m) : Matrix<T>(), pinned(false) {
+template<class T> HostMatrix<T>::HostMatrix(const HostMatrix<T>& m) : Matrix<T>(), pitch(0), pinned(false), category(m.category), aligned(m.aligned), capacity(0) {
 	*this = m;
 }
 
+#if __cplusplus >= 201103L
+template<class T> HostMatrix<T>::HostMatrix(HostMatrix<T>&& m) noexcept : Matrix<T>(), pitch(0), pinned(false), category(m.category), aligned(m.aligned), capacity(0) {
+  swap(m);
+}
+
+template<class T> HostMatrix<T>& HostMatrix<T>::operator=(HostMatrix<T>&& m) noexcept {
+  swap(m); // m takes the old storage and frees it
+  return *this;
+}
+#endif
+
+template<class T> void HostMatrix<T>::swap(HostMatrix<T>& other) {
+  std::swap(this->data, other.data);
+  std::swap(this->width, other.width);
+  std::swap(this->height, other.height);
+  std::swap(this->pitch, other.pitch);
+  std::swap(pinned, other.pinned);
+  std::swap(category, other.category);
+  std::swap(aligned, other.aligned);
+  std::swap(capacity, other.capacity);
+}
+
+template<class T> void HostMatrix<T>::set_category(MemoryCategory _category) {
+  if (this->data) {
+    HostMemory::released(category, capacity * sizeof(T));
+    HostMemory::allocated(_category, capacity * sizeof(T));
+  }
+  category = _category;
+}
+
+template<class T> void HostMatrix<T>::set_aligned(bool _aligned) {
+  assert(!pinned || !_aligned);
+  if (this->data && aligned != _aligned) deallocate();
+  aligned = _aligned;
+}
+
 template<class T> HostMatrix<T>::~HostMatrix(void) {
 	deallocate();
 }
@@ -97,25 +155,44 @@ template<class T> HostMatrix<T>& HostMatrix<T>::resize(unsigned int _width, unsi
 	return *this;
 }
 
+template<class T> HostMatrix<T>& HostMatrix<T>::reshape(unsigned int _width, unsigned _height) {
+  if (_width == 0 || _height == 0) throw std::runtime_error("La dimension no puede ser 0");
+  unsigned int _pitch = (aligned ? aligned_pitch(_width) : _width);
+  if ((size_t)_pitch * _height > capacity) return resize(_width, _height);
+  this->width = _width; this->height = _height; this->pitch = _pitch;
+  // the padding of the rows may hold elements of the previous shape
+  if (_pitch > _width) {
+    for (uint j = 0; j < _height; j++) memset(&this->data[(size_t)j * _pitch + _width], 0, (_pitch - _width) * sizeof(T));
+  }
+  return *this;
+}
+
 template<class T> HostMatrix<T>& HostMatrix<T>::shrink(unsigned int _width, unsigned int _height) {
   if (_width == 0 || _height == 0) throw std::runtime_error("La dimension no puede ser 0");
   if (_width != this->width || _height != this->height) {
-    HostMatrix<T> temp_matrix(_width, _height);
-    temp_matrix.copy_submatrix(temp_matrix, _width * _height);
-    resize(_width, _height);
-    *this = temp_matrix;
+    // keeps the top left elements, in storage of the new size
+    HostMatrix<T> shrunk;
+    shrunk.set_category(category);
+    shrunk.set_aligned(aligned);
+    shrunk.resize(_width, _height);
+    if (this->data) {
+      for (uint j = 0; j < std::min(_height, this->height); j++)
+        memcpy(shrunk.ptr(0, j), ptr(0, j), std::min(_width, this->width) * sizeof(T));
+    }
+    swap(shrunk);
   }
 
 	return *this;
 }
 
 template<class T> HostMatrix<T>& HostMatrix<T>::zero(void) {
-  memset(this->data, 0, this->bytes());
+  memset(this->data, 0, storage_bytes());
 	return *this;
 }
 
 template<class T> HostMatrix<T>& HostMatrix<T>::fill(T value) {
-  for (uint i = 0; i < this->elements(); i++) { this->data[i] = value; }
+  for (uint j = 0; j < this->height; j++)
+    for (uint i = 0; i < this->width; i++) { (*this)(i, j) = value; }
   return *this;
 }
 
@@ -123,11 +200,11 @@ template<class T> HostMatrix<T>& HostMatrix<T>::operator=(const HostMatrix<T>& c
 	assert(!this->pinned);
 
 	if (!c.data) {
-		if (this->data) { dealloc_data(); this->width = this->height = 0; this->data = NULL; }
+		if (this->data) deallocate();
 	}
 	else {
 		if (this->data) {
-			if (this->bytes() != c.bytes()) {
+			if (this->width != c.width || this->height != c.height) {
 				dealloc_data();
 				this->width = c.width; this->height = c.height;
 				alloc_data();
@@ -138,7 +215,10 @@ template<class T> HostMatrix<T>& HostMatrix<T>::operator=(const HostMatrix<T>& c
 			alloc_data();
 		}
 
-		copy_submatrix(c);
+		if (this->pitch == c.pitch) memcpy(this->data, c.data, storage_bytes());
+		else {
+			for (uint j = 0; j < this->height; j++) memcpy(ptr(0, j), &c(0, j), this->width * sizeof(T));
+		}
 	}
 
 	return *this;
@@ -168,11 +248,18 @@ template <class T> HostMatrix<T>& HostMatrix<T>::operator=(const CudaMatrix<T>&
 }
 
 template<class T> void HostMatrix<T>::copy_submatrix(const HostMatrix<T>& c, unsigned int _elements) {
-	unsigned int _bytes = (_elements == 0 ? this->bytes() : _elements * sizeof(T));
-	//cout << "bytes: " << _bytes << ", c.bytes: " << c.bytes() << endl;
-	if (_bytes > c.bytes())
+	unsigned int _count = (_elements == 0 ? this->elements() : _elements);
+	if (_count > c.elements())
     throw runtime_error("Can't copy more elements than what operator has");
-	memcpy(this->data, c.data, _bytes);
+
+  // the first _count elements in row order, each matrix with its own row padding
+  if (this->pitch == this->width && c.pitch == c.width) {
+    memcpy(this->data, c.data, _count * sizeof(T));
+    return;
+  }
+  if (this->width != c.width) throw runtime_error("Can't copy between padded matrices of different widths");
+  for (uint j = 0; j * this->width < _count; j++)
+    memcpy(ptr(0, j), &c(0, j), std::min(this->width, _count - j * this->width) * sizeof(T));
 }
 
 template<class T> void HostMatrix<T>::copy_submatrix(const CudaMatrix<T>& c, unsigned int _elements) {
@@ -232,7 +319,7 @@ void HostMatrix<T>::blas_ssyr(UpperLowerTriangle triangle, float alpha, const Ho
   if (x_row >= x.height || x.width != A.width || A.width != A.height) throw runtime_error("Wrong dimensions for ssyr");
   int n = x.width;
 
-  cblas_ssyr(CblasRowMajor, blas_triangle, n, alpha, (float*)&x.data[x_row * x.width], 1, (float *)A.data, n);
+  cblas_ssyr(CblasRowMajor, blas_triangle, n, alpha, (float*)&x(0, x_row), 1, (float *)A.data, A.pitch);
 }
 
 template<class T>
@@ -241,7 +328,7 @@ void HostMatrix<T>::blas_ssyr(UpperLowerTriangle triangle, double alpha, const H
   if (x_row >= x.height || x.width != A.width || A.width != A.height) throw runtime_error("Wrong dimensions for dsyr");
   int n = x.width;
 
-  cblas_dsyr(CblasRowMajor, blas_triangle, n, alpha, (double*)&x.data[x_row * x.width], 1, (double *)A.data, n);
+  cblas_dsyr(CblasRowMajor, blas_triangle, n, alpha, (double*)&x(0, x_row), 1, (double *)A.data, A.pitch);
 }
 
 template<class T> void HostMatrix<T>::check_values(void) {
@@ -302,6 +389,12 @@ template<class T> CudaMatrix<T>::~CudaMatrix(void) {
   deallocate();
 }
 
+template<class T> void CudaMatrix<T>::swap(CudaMatrix<T>& other) {
+  std::swap(this->data, other.data);
+  std::swap(this->width, other.width);
+  std::swap(this->height, other.height);
+}
+
 template<class T> void CudaMatrix<T>::deallocate(void) {
   #if !CPU_KERNELS
 	if (this->data) cudaFree(this->data);
@@ -314,6 +407,7 @@ template<class T> void CudaMatrix<T>::copy_submatrix(const HostMatrix<T>& c, uns
 	unsigned int _bytes = (_elements == 0 ? this->bytes() : _elements * sizeof(T));
 	//cout << "bytes: " << _bytes << ", c.bytes: " << c.bytes() << endl;
 	if (_bytes > c.bytes()) throw runtime_error("CudaMatrix: Can't copy more elements than what operand has");
+  assert(c.pitch == c.width); // aligned host matrices are only used by the CPU kernels
 
   #if !CPU_KERNELS
 	cudaMemcpy(this->data, c.data, _bytes, cudaMemcpyHostToDevice);
@@ -2,6 +2,7 @@
 #define __G2G_MATRIX_H__
 
 #include <vector>
+#include <algorithm>
 #include "cpu/cpu_vector_types.h"
 
 // TODO: para cuando es multiplo, le suma igual y no deberia
@@ -11,8 +12,12 @@
 #define COALESCED_DIMENSION(d) (d + 16 - (d % 16))
 #endif
 
+// alignment of the rows of aligned HostMatrix (a cache line)
+#define HOST_ALIGNMENT 64
+
 #include "cuda_includes.h"
 #include "scalar_vector_types.h"
+#include "host_memory.h"
 
 namespace G2G {
   enum UpperLowerTriangle { UpperTriangle, LowerTriangle };
@@ -50,23 +55,41 @@ namespace G2G {
 			HostMatrix<T>& operator=(const CudaMatrix<T>& c);
 			HostMatrix<T>& operator=(const HostMatrix<T>& c);
 
+#if __cplusplus >= 201103L
+			HostMatrix(HostMatrix<T>&& c) noexcept;
+			HostMatrix<T>& operator=(HostMatrix<T>&& c) noexcept;
+#endif
+			// exchanges the storage of both matrices, with its category, alignment and accounting
+			void swap(HostMatrix<T>& other);
+
 			inline const T& operator()(unsigned int i = 0, unsigned int j = 0) const {
 				assert(i < this->width);
 				assert(j < this->height);
-                                return this->data[j * this->width + i];
+                                return this->data[j * this->pitch + i];
 			}
 			inline T& operator()(unsigned int i = 0, unsigned int j = 0) {
 				assert(i < this->width);
 				assert(j < this->height);
-				return this->data[j * this->width + i];
+				return this->data[j * this->pitch + i];
 			}
 
       inline T* ptr(unsigned int i = 0, unsigned int j = 0) {
         assert(i < this->width);
 				assert(j < this->height);
-				return &this->data[j * this->width + i];
+				return &this->data[j * this->pitch + i];
       }
 
+      // elements from the start of one row to the next: width, plus the padding of aligned matrices
+      unsigned int pitch;
+      // elements and bytes of the rows including their padding (as laid out in data)
+      inline size_t storage_elements(void) const { return (size_t)this->pitch * this->height; }
+      inline size_t storage_bytes(void) const { return storage_elements() * sizeof(T); }
+
+      /* HOST_ALIGNMENT aligned storage, each row padded to whole cache lines (so rows start aligned too);
+         takes effect on the next allocation. The padding is zeroed on allocation and by reshape */
+      void set_aligned(bool aligned);
+      static unsigned int aligned_pitch(unsigned int width);
+
 			void copy_submatrix(const CudaMatrix<T>& c, unsigned int elements = 0);
 			void copy_submatrix(const HostMatrix<T>& c, unsigned int elements = 0);
 
@@ -74,6 +97,8 @@ namespace G2G {
       void transpose(HostMatrix<T>& out);
 
       HostMatrix<T>& resize(unsigned int width, unsigned int height = 1);
+      // as resize, but keeps the allocation (not the contents) while it is large enough, for buffers reused between groups
+      HostMatrix<T>& reshape(unsigned int width, unsigned int height = 1);
       HostMatrix<T>& shrink(unsigned int width, unsigned int height = 1);
 			HostMatrix<T>& zero(void);
       HostMatrix<T>& fill(T value);
@@ -88,8 +113,14 @@ namespace G2G {
 
 			void to_constant(const char* constant);
 
+      /* what the matrix holds, for the host memory accounting (copies take the category of the source) */
+      void set_category(MemoryCategory category);
+
 		private:
 			bool pinned;
+			MemoryCategory category;
+			bool aligned;
+			unsigned int capacity; // elements allocated, at least pitch * height
 			void alloc_data(void);
 			void dealloc_data(void);
 	};
@@ -115,6 +146,8 @@ namespace G2G {
 			CudaMatrix& operator=(const CudaMatrix<T>& c);
       CudaMatrix& operator=(const std::vector<T>& v);
 
+			void swap(CudaMatrix<T>& other);
+
 			void copy_submatrix(const HostMatrix<T>& c, unsigned int elements = 0);
 			void copy_submatrix(const CudaMatrix<T>& c, unsigned int elements = 0);
       void copy_submatrix(const std::vector<T>& v, unsigned int elements = 0);
@@ -143,6 +176,10 @@ namespace G2G {
 			unsigned int fortran_width;
 	};
 
+	using std::swap; // not hidden inside G2G by the overloads below
+	template<class T> inline void swap(HostMatrix<T>& a, HostMatrix<T>& b) { a.swap(b); }
+	template<class T> inline void swap(CudaMatrix<T>& a, CudaMatrix<T>& b) { a.swap(b); }
+
 	typedef HostMatrix<double> HostMatrixDouble;
 	typedef HostMatrix<double3> HostMatrixDouble3;
 	typedef HostMatrix<float> HostMatrixFloat;
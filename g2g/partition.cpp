@@ -4,6 +4,7 @@
 #include <vector>
 #include <cmath>
 #include <algorithm>
+#include <iterator>
 #include "common.h"
 #include "init.h"
 #include "matrix.h"
@@ -18,7 +19,17 @@ ostream& operator<<(ostream& io, const Timers& t) {
 #ifdef TIMINGS
   cout << "iteration: " << t.total << endl;
   cout << "rmm: " << t.rmm << " density: " << t.density << " pot: " << t.pot << " forces: " << t.forces << " resto: " << t.resto << " functions: " << t.functions << endl;
+#if CPU_KERNELS
+  cout << "point loop (" << t.point_density.active_threads() << " threads): density: " << t.point_density << " pot: " << t.point_pot
+       << " forces: " << t.point_forces << " rmm: " << t.point_rmm << endl;
 #endif
+#endif
+  if (!t.perf_density.empty()) {
+    cout << "counters functions: " << t.perf_functions << endl;
+    cout << "counters density: " << t.perf_density << endl;
+    cout << "counters rmm: " << t.perf_rmm << endl;
+    cout << "counters forces: " << t.perf_forces << endl;
+  }
   return io;
 }
 
@@ -31,12 +42,12 @@ void PointGroup<scalar_type>::get_rmm_input(HostMatrix<scalar_type>& rmm_input,
     FortranMatrix<double>& source) const {
   rmm_input.zero();
   for (uint i = 0, ii = 0; i < total_functions_simple(); i++) {
-    uint inc_i = small_function_type(i);
+    uint inc_i = small_function_size(i);
 
     for (uint k = 0; k < inc_i; k++, ii++) {
       uint big_i = local2global_func[i] + k;
       for (uint j = 0, jj = 0; j < total_functions_simple(); j++) {
-        uint inc_j = small_function_type(j);
+        uint inc_j = small_function_size(j);
 
         for (uint l = 0; l < inc_j; l++, jj++) {
           uint big_j = local2global_func[j] + l;
@@ -67,12 +78,12 @@ template<class scalar_type>
 void PointGroup<scalar_type>::add_rmm_output(const HostMatrix<scalar_type>& rmm_output,
     FortranMatrix<double>& target ) const {
   for (uint i = 0, ii = 0; i < total_functions_simple(); i++) {
-    uint inc_i = small_function_type(i);
+    uint inc_i = small_function_size(i);
 
     for (uint k = 0; k < inc_i; k++, ii++) {
       uint big_i = local2global_func[i] + k;
       for (uint j = 0, jj = 0; j < total_functions_simple(); j++) {
-        uint inc_j = small_function_type(j);
+        uint inc_j = small_function_size(j);
 
         for (uint l = 0; l < inc_j; l++, jj++) {
           uint big_j = local2global_func[j] + l;
@@ -122,10 +133,49 @@ void PointGroup<scalar_type>::compute_nucleii_maps(void)
       uint global_atom = func2global_nuc(i);
       uint local_atom = std::distance(local2global_nuc.begin(),
           std::find(local2global_nuc.begin(), local2global_nuc.end(), global_atom));
-      uint inc = small_function_type(i);
+      uint inc = small_function_size(i);
       for (uint k = 0; k < inc; k++, ii++) func2local_nuc(ii) = local_atom;
     }
   }
+#if CPU_KERNELS
+  primitive_table_flags = -1; // the functions changed
+#endif
+}
+
+template<class scalar_type>
+void PointGroup<scalar_type>::swap(PointGroup<scalar_type>& other) {
+  points.swap(other.points);
+  std::swap(number_of_points, other.number_of_points);
+  std::swap(s_functions, other.s_functions);
+  std::swap(p_functions, other.p_functions);
+  std::swap(d_functions, other.d_functions);
+  func2global_nuc.swap(other.func2global_nuc);
+  func2local_nuc.swap(other.func2local_nuc);
+  local2global_func.swap(other.local2global_func);
+  local2global_nuc.swap(other.local2global_nuc);
+  function_values.swap(other.function_values);
+  gradient_values.swap(other.gradient_values);
+#if CPU_KERNELS
+  hessian_values.swap(other.hessian_values);
+  compressed_function_values.swap(other.compressed_function_values);
+  compressed_gradient_values.swap(other.compressed_gradient_values);
+  compressed_hessian_values.swap(other.compressed_hessian_values);
+  std::swap(spilled, other.spilled);
+  std::swap(spill_offset, other.spill_offset);
+  std::swap(spilled_gradients, other.spilled_gradients);
+  std::swap(spilled_hessians, other.spilled_hessians);
+  std::swap(recompute_functions, other.recompute_functions);
+  primitive_nuc.swap(other.primitive_nuc);
+  func_primitives_start.swap(other.func_primitives_start);
+  func_primitives.swap(other.func_primitives);
+  primitive_exps.swap(other.primitive_exps);
+  primitive_cutoffs.swap(other.primitive_cutoffs);
+  func_coeffs.swap(other.func_coeffs);
+  std::swap(primitive_table_flags, other.primitive_table_flags);
+#else
+  hessian_values_transposed.swap(other.hessian_values_transposed);
+#endif
+  std::swap(inGlobal, other.inGlobal);
 }
 
 template<class scalar_type>
@@ -134,6 +184,32 @@ void PointGroup<scalar_type>::add_point(const Point& p) {
   number_of_points++;
 }
 
+template<class scalar_type>
+void PointGroup<scalar_type>::merge(const PointGroup<scalar_type>& other) {
+  points.insert(points.end(), other.points.begin(), other.points.end());
+  number_of_points += other.number_of_points;
+
+  vector<uint> functions;
+  set_union(local2global_func.begin(), local2global_func.end(), other.local2global_func.begin(), other.local2global_func.end(),
+    back_inserter(functions));
+  local2global_func.swap(functions);
+
+  vector<uint> nucleii;
+  set_union(local2global_nuc.begin(), local2global_nuc.end(), other.local2global_nuc.begin(), other.local2global_nuc.end(),
+    back_inserter(nucleii));
+  local2global_nuc.swap(nucleii);
+
+  // functions are sorted by global index, which orders them as s, p, d
+  s_functions = p_functions = d_functions = 0;
+  for (uint i = 0; i < total_functions_simple(); i++) {
+    if (local2global_func[i] < fortran_vars.s_funcs) s_functions++;
+    else if (local2global_func[i] < fortran_vars.s_funcs + fortran_vars.p_funcs * 3) p_functions++;
+    else d_functions++;
+  }
+
+  compute_nucleii_maps();
+}
+
 #define EXP_PREFACTOR 1.01057089636005 // (2 * pow(4, 1/3.0)) / M_PI
 
 template<class scalar_type>
@@ -198,10 +274,38 @@ PointGroup<scalar_type>::~PointGroup<scalar_type>()
 Sphere::Sphere(void) : atom(0), radius(0) { }
 Sphere::Sphere(uint _atom, double _radius) : atom(_atom), radius(_radius) { }
 
+void Sphere::swap(Sphere& other) {
+  PointGroup::swap(other);
+  std::swap(atom, other.atom);
+  std::swap(radius, other.radius);
+}
+
 /**********************
  * Cube
  **********************/
 
 template class PointGroup<double>;
 template class PointGroup<float>;
+
+/********************
+ * Partition
+ ********************/
+template<class T> static void add_storage(const std::vector<T>& groups, size_t& points, size_t& compressed) {
+  for (typename std::vector<T>::const_iterator it = groups.begin(); it != groups.end(); ++it) {
+    points += it->points.capacity() * sizeof(Point);
+#if CPU_KERNELS
+    compressed += it->compressed_table_bytes();
+#endif
+  }
+}
+
+void Partition::account_storage(void) {
+  HostMemory::released(MEMORY_POINTS, point_storage);
+  HostMemory::released(MEMORY_FUNCTIONS, compressed_storage);
+  point_storage = compressed_storage = 0;
+  add_storage(cubes, point_storage, compressed_storage);
+  add_storage(spheres, point_storage, compressed_storage);
+  HostMemory::allocated(MEMORY_POINTS, point_storage);
+  HostMemory::allocated(MEMORY_FUNCTIONS, compressed_storage);
+}
 }
@@ -8,16 +8,29 @@
 #include <iostream>
 #include "scalar_vector_types.h"
 #include "timer.h"
+#include "trace.h"
+#include "perf_counters.h"
+#include "init.h"
 
 #include "global_memory_pool.h"
+#if CPU_KERNELS
+#include "cpu/compressed_matrix.h"
+#include "cpu/spill_area.h"
+#endif
 
 namespace G2G {
   struct Timers {
     Timer total, ciclos, rmm, density, forces, resto, pot, functions, density_derivs;
+    // phases of the OpenMP point loop of the CPU kernels, timed by each thread
+    ThreadTimer point_density, point_pot, point_forces, point_rmm;
+    // hardware counters (option perf_counters) of the whole phases; density includes the point loop
+    PerfCounters perf_functions, perf_density, perf_rmm, perf_forces;
   };
 
   std::ostream& operator<<(std::ostream& io, const Timers& t);
 
+  double report_clock(void); // wall clock seconds, used for the partition report
+
 /********************
  * Point information
  ********************/
@@ -35,8 +48,32 @@ enum FunctionType { FUNCTION_S = 1, FUNCTION_P = 3, FUNCTION_D = 6 };
 template<class scalar_type>
 class PointGroup {
   public:
-    PointGroup(void) : number_of_points(0), s_functions(0), p_functions(0), d_functions(0), inGlobal(false) {  }
+    PointGroup(void) : number_of_points(0), s_functions(0), p_functions(0), d_functions(0)
+    #if CPU_KERNELS
+      , spilled(false), spill_offset(0), spilled_gradients(false), spilled_hessians(false), recompute_functions(false),
+      primitive_table_flags(-1)
+    #endif
+      , inGlobal(false) {
+    #if CPU_KERNELS
+        function_values.set_category(MEMORY_FUNCTIONS);
+        gradient_values.set_category(MEMORY_DERIVATIVES);
+        hessian_values.set_category(MEMORY_DERIVATIVES);
+        // each point (row) starts on a cache line
+        function_values.set_aligned(true);
+        gradient_values.set_aligned(true);
+        hessian_values.set_aligned(true);
+    #endif
+      }
     virtual ~PointGroup(void);
+#if __cplusplus >= 201103L
+    PointGroup(const PointGroup<scalar_type>&) = default;
+    PointGroup<scalar_type>& operator=(const PointGroup<scalar_type>&) = default;
+    PointGroup(PointGroup<scalar_type>&& other) noexcept : PointGroup() { swap(other); }
+    PointGroup<scalar_type>& operator=(PointGroup<scalar_type>&& other) noexcept { swap(other); return *this; }
+#endif
+    // exchanges the points, functions and tables of both groups, without copying them
+    void swap(PointGroup<scalar_type>& other);
+
     std::vector<Point> points;
     uint number_of_points;
     uint s_functions, p_functions, d_functions;
@@ -55,6 +92,25 @@ class PointGroup {
     G2G::HostMatrix<scalar_type> function_values;
     G2G::HostMatrix<vec_type3> gradient_values;
     G2G::HostMatrix<vec_type3> hessian_values;
+
+    // reduced precision copies of the tables above, used when compressed_functions is set
+    G2G::CompressedMatrix<scalar_type> compressed_function_values;
+    G2G::CompressedMatrix<scalar_type> compressed_gradient_values;
+    G2G::CompressedMatrix<scalar_type> compressed_hessian_values;
+
+    // location of the tables above in spill_area, used when spill_directory is set
+    bool spilled;
+    size_t spill_offset;
+    bool spilled_gradients, spilled_hessians;
+
+    // the tables didn't fit in max_host_memory: they are computed again on every solve
+    bool recompute_functions;
+
+    // distinct (atom, exponent) primitives of the functions and the contraction of each function over them,
+    // built by compute_functions and kept for the next solves
+    std::vector<uint> primitive_nuc, func_primitives_start, func_primitives;
+    std::vector<scalar_type> primitive_exps, primitive_cutoffs, func_coeffs;
+    int primitive_table_flags; // forces + 2 * gga of the cutoffs, -1 when the table has to be built
     #else
     G2G::CudaMatrix<scalar_type> function_values;
     G2G::CudaMatrix<vec_type4> gradient_values;
@@ -66,8 +122,14 @@ class PointGroup {
       else if (f < s_functions + p_functions) return FUNCTION_P;
       else return FUNCTION_D;
     }
+    // number of components of the function (d has 5 when spherical_d_functions is set)
+    inline uint small_function_size(uint f) const {
+      if (f < s_functions) return 1;
+      else if (f < s_functions + p_functions) return 3;
+      else return fortran_vars.d_components;
+    }
     //Las funciones totales, son totales del grupo, no las totales para todos los grupos.
-    inline uint total_functions(void) const { return s_functions + p_functions * 3 + d_functions * 6; }
+    inline uint total_functions(void) const { return s_functions + p_functions * 3 + d_functions * fortran_vars.d_components; }
     inline uint total_functions_simple(void) const { return local2global_func.size(); } // == s_functions + p_functions + d_functions
     inline uint total_nucleii(void) const { return local2global_nuc.size(); }
     inline bool has_nucleii(uint atom) const { return (std::find(local2global_nuc.begin(), local2global_nuc.end(), atom) != local2global_nuc.end()); }
@@ -86,11 +148,28 @@ class PointGroup {
 
     void add_point(const Point& p);
     void compute_weights(void);
+    void merge(const PointGroup<scalar_type>& other); // absorbs the (already weighted) points and functions of other
 
     void compute_functions(bool forces, bool gga);
+    #if CPU_KERNELS
+    void build_primitive_table(bool forces, bool gga);
+    void compress_functions(void);
+    void decompress_functions(void);
+    size_t function_table_bytes(bool forces, bool gga) const;
+    size_t cached_table_bytes(bool forces, bool gga) const; // kept between solves: function_table_bytes, or less if compressed
+    inline size_t compressed_table_bytes(void) const {
+      return compressed_function_values.bytes() + compressed_gradient_values.bytes() + compressed_hessian_values.bytes();
+    }
+    void spill_functions(size_t offset);
+    void restore_functions(void);
+    void prefetch_functions(void) const;
+    #endif
     void solve(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,double&,double&,double&,double&,double&,double* fort_forces_ptr, bool open);
     void solve_closed(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,double&,double* fort_forces_ptr);
     void solve_opened(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,double&,double&,double&,double&,double&,double* fort_forces_ptr);
+    #if CPU_KERNELS
+    template<class kernel_type> void solve_closed_kernel(Timers& timers, bool compute_rmm, bool lda, bool compute_forces, bool compute_energy,double&,double* fort_forces_ptr);
+    #endif
 
     bool is_significative(FunctionType, double exponent, double coeff, double d2);
     bool operator<(const PointGroup<scalar_type>& T) const;
@@ -113,6 +192,8 @@ class Sphere : public PointGroup<float> {
     Sphere(void);
     Sphere(uint _atom, double _radius);
 
+    void swap(Sphere& other);
+
     void assign_significative_functions(const std::vector<double>& min_exps, const std::vector<double>& min_coeff);
     bool is_sphere(void) { return true; }
     bool is_cube(void) { return false; }
@@ -129,17 +210,27 @@ class Cube : public PointGroup<float> {
 #endif
   public:
     void assign_significative_functions(const double3& cube_coord, const std::vector<double>& min_exps, const std::vector<double>& min_coeff);
+    void assign_significative_functions(const double3& box_min, const double3& box_max, const std::vector<double>& min_exps, const std::vector<double>& min_coeff);
     bool is_sphere(void) { return false; }
     bool is_cube(void) { return true; }
 
 };
 
+inline void swap(Cube& a, Cube& b) { a.swap(b); }
+inline void swap(Sphere& a, Sphere& b) { a.swap(b); }
+
 // =======Partition Class ========//
 
 class Partition {
   public:
+    Partition(void) : report_pending(false), point_storage(0), compressed_storage(0) { }
+
     void clear(void) {
       cubes.clear(); spheres.clear();
+      account_storage();
+#if CPU_KERNELS
+      spill_area.clear();
+#endif
     }
 
     void solve(Timers& timers, bool compute_rmm,bool lda,bool compute_forces, bool compute_energy, double* fort_energy_ptr, double* fort_forces_ptr, bool OPEN)
@@ -150,12 +241,36 @@ class Partition {
       double cubes_energy_c1 = 0, spheres_energy_c1 = 0;
       double cubes_energy_c2 = 0, spheres_energy_c2 = 0;
 
+      // the first solve after regenerate measures each group for the partition report
+      bool report = report_pending;
+      std::vector<double> measured;
+
       for (std::vector<Cube>::iterator it = cubes.begin(); it != cubes.end(); ++it) {
+#if CPU_KERNELS
+        if (it + 1 != cubes.end()) (it + 1)->prefetch_functions();
+        else if (!spheres.empty()) spheres.front().prefetch_functions();
+#endif
+        double t0 = (report ? report_clock() : 0);
+        trace_begin("cube", it->number_of_points, it->total_functions());
         it->solve(timers, compute_rmm,lda,compute_forces, compute_energy, cubes_energy, cubes_energy_i, cubes_energy_c, cubes_energy_c1, cubes_energy_c2, fort_forces_ptr, OPEN);
+        trace_end("cube");
+        if (report) measured.push_back(report_clock() - t0);
       }
 
       for (std::vector<Sphere>::iterator it = spheres.begin(); it != spheres.end(); ++it) {
+#if CPU_KERNELS
+        if (it + 1 != spheres.end()) (it + 1)->prefetch_functions();
+#endif
+        double t0 = (report ? report_clock() : 0);
+        trace_begin("sphere", it->number_of_points, it->total_functions());
         it->solve(timers, compute_rmm,lda,compute_forces, compute_energy, spheres_energy, spheres_energy_i, spheres_energy_c, spheres_energy_c1, spheres_energy_c2, fort_forces_ptr, OPEN);
+        trace_end("sphere");
+        if (report) measured.push_back(report_clock() - t0);
+      }
+
+      if (report) {
+        write_report(measured, timers);
+        report_pending = false;
       }
 
       if(OPEN && compute_energy) {
@@ -177,24 +292,79 @@ class Partition {
     }
 
     void regenerate(void);
+    void write_report(const std::vector<double>& measured, const Timers& timers) const; // measured: solve time of each cube, then each sphere
 
     void compute_functions(bool forces, bool gga)
     {
       Timer t1;
       t1.start_and_sync();
-      for (std::vector<Cube>::iterator it = cubes.begin(); it != cubes.end(); ++it)
-        it->compute_functions(forces, gga);
-      for (std::vector<Sphere>::iterator it = spheres.begin(); it != spheres.end(); ++it)
-        it->compute_functions(forces, gga);
+      size_t spill_offset = 0;
+#if CPU_KERNELS
+      // the compressed tables are accounted as they are built, for max_host_memory to see them
+      HostMemory::released(MEMORY_FUNCTIONS, compressed_storage);
+      compressed_storage = 0;
+      if (!spill_directory.empty()) {
+        size_t spill_bytes = 0;
+        for (std::vector<Cube>::iterator it = cubes.begin(); it != cubes.end(); ++it)
+          spill_bytes += it->function_table_bytes(forces, gga);
+        for (std::vector<Sphere>::iterator it = spheres.begin(); it != spheres.end(); ++it)
+          spill_bytes += it->function_table_bytes(forces, gga);
+        spill_area.reserve(spill_bytes);
+      }
+#endif
+      uint recomputed = 0;
+      compute_group_functions(cubes, forces, gga, spill_offset, recomputed);
+      compute_group_functions(spheres, forces, gga, spill_offset, recomputed);
+      if (recomputed > 0)
+        std::cout << "max_host_memory: " << recomputed << " of " << cubes.size() + spheres.size() << " groups recompute their functions" << std::endl;
+      account_storage();
       t1.stop_and_sync();
 //      std::cout << "TIMER: funcs: " << t1 << std::endl;
     }
 
     std::vector<Cube> cubes;
     std::vector<Sphere> spheres;
+
+    // records the bytes of the points and compressed tables of the groups in the host memory accounting
+    void account_storage(void);
+
+  private:
+    bool report_pending;
+    size_t point_storage, compressed_storage; // accounted by the last account_storage
+
+    template<class T> void compute_group_functions(std::vector<T>& groups, bool forces, bool gga, size_t& spill_offset, uint& recomputed)
+    {
+      for (typename std::vector<T>::iterator it = groups.begin(); it != groups.end(); ++it) {
+#if CPU_KERNELS
+        it->recompute_functions = false;
+        if (!spill_area.is_mapped() && !HostMemory::fits(it->cached_table_bytes(forces, gga))) {
+          it->recompute_functions = true;
+          recomputed++;
+          continue;
+        }
+#endif
+        it->compute_functions(forces, gga);
+#if CPU_KERNELS
+        if (spill_area.is_mapped()) {
+          it->spill_functions(spill_offset);
+          spill_offset += it->function_table_bytes(forces, gga);
+        }
+        else if (compressed_functions) {
+          it->compress_functions();
+          HostMemory::allocated(MEMORY_FUNCTIONS, it->compressed_table_bytes());
+          compressed_storage += it->compressed_table_bytes();
+        }
+#endif
+      }
+    }
 };
 
 extern Partition partition;
+
+#if CPU_KERNELS
+// frees the temporaries the CPU solves keep between groups and iterations
+void release_solve_buffers(void);
+#endif
 }
 
 #endif
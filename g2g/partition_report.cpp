@@ -0,0 +1,165 @@
+#include <iostream>
+#include <fstream>
+#include <vector>
+#include <string>
+#include <cmath>
+#include <stdexcept>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "common.h"
+#include "init.h"
+#include "partition.h"
+using namespace std;
+
+namespace G2G {
+
+/* statistics of one group, as written to the report */
+struct GroupReport {
+  const char* type;
+  uint points, functions;
+  double cost, measured;
+};
+
+double report_clock(void) {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+/* counts of values in power of two bins: bin k holds [2^k, 2^(k+1)), bin 0 also holds 0 */
+static vector<uint> histogram(const vector<double>& values) {
+  vector<uint> bins;
+  for (uint i = 0; i < values.size(); i++) {
+    uint bin = 0;
+    for (double v = values[i]; v >= 2; v /= 2) bin++;
+    if (bin >= bins.size()) bins.resize(bin + 1, 0);
+    bins[bin]++;
+  }
+  return bins;
+}
+
+/* the groups are solved one after the other, with the threads sharing the points of each group: the imbalance of
+ * the run is that of the point loops, measured by their thread timers (slowest / mean thread) */
+static const char* point_phases[4] = { "density", "pot", "forces", "rmm" };
+
+static void point_loop_imbalance(const Timers& timers, double imbalance[4]) {
+  const ThreadTimer* phases[4] = { &timers.point_density, &timers.point_pot, &timers.point_forces, &timers.point_rmm };
+  for (uint i = 0; i < 4; i++) imbalance[i] = (phases[i]->active_threads() == 0 ? 0 : phases[i]->imbalance());
+}
+
+template<class T> static void add_groups(const vector<T>& groups, const char* type, const vector<double>& measured, vector<GroupReport>& report) {
+  for (uint i = 0; i < groups.size(); i++) {
+    GroupReport group;
+    group.type = type;
+    group.points = groups[i].number_of_points;
+    group.functions = groups[i].total_functions();
+    group.cost = (double)group.points * group.functions * group.functions;
+    group.measured = measured[report.size()];
+    report.push_back(group);
+  }
+}
+
+static void write_histogram(ostream& out, const char* name, const vector<uint>& bins, bool csv) {
+  if (csv) {
+    out << "# histogram " << name << " (bin k: [2^k, 2^(k+1)))";
+    for (uint k = 0; k < bins.size(); k++) out << (k == 0 ? " " : ",") << bins[k];
+    out << endl;
+  }
+  else {
+    out << "    \"" << name << "\": [";
+    for (uint k = 0; k < bins.size(); k++) out << (k == 0 ? "" : ", ") << bins[k];
+    out << "]";
+  }
+}
+
+void Partition::write_report(const vector<double>& measured, const Timers& timers) const {
+  vector<GroupReport> groups;
+  add_groups(cubes, "cube", measured, groups);
+  add_groups(spheres, "sphere", measured, groups);
+
+  // seconds per unit of points * functions^2, fitted by least squares
+  double cost_measured = 0, cost_cost = 0;
+  for (uint i = 0; i < groups.size(); i++) { cost_measured += groups[i].cost * groups[i].measured; cost_cost += groups[i].cost * groups[i].cost; }
+  double scale = (cost_cost == 0 ? 0 : cost_measured / cost_cost);
+  // how well points * functions^2 predicts the measured times: relative RMS error of the fit
+  double residual = 0, measured_measured = 0;
+  for (uint i = 0; i < groups.size(); i++) {
+    double error = groups[i].measured - scale * groups[i].cost;
+    residual += error * error;
+    measured_measured += groups[i].measured * groups[i].measured;
+  }
+  double cost_error = (measured_measured == 0 ? 0 : sqrt(residual / measured_measured));
+
+  vector<double> points, functions, costs;
+  double total_points = 0, total_functions = 0, total_cost = 0, total_time = 0, nco_m = 0, m_m = 0;
+  for (uint i = 0; i < groups.size(); i++) {
+    points.push_back(groups[i].points);
+    functions.push_back(groups[i].functions);
+    costs.push_back(groups[i].cost);
+    total_points += groups[i].points;
+    total_functions += (double)groups[i].points * groups[i].functions;
+    total_cost += groups[i].cost;
+    total_time += groups[i].measured;
+    nco_m += (double)groups[i].functions * fortran_vars.nco;
+    m_m += (double)groups[i].functions * groups[i].functions;
+  }
+
+#ifdef _OPENMP
+  uint threads = omp_get_max_threads();
+#else
+  uint threads = 1;
+#endif
+  // only measured with TIMINGS: 0 otherwise (and for the phases that didn't run)
+  double imbalance[4];
+  point_loop_imbalance(timers, imbalance);
+
+  ofstream out(partition_report.c_str());
+  if (!out) throw runtime_error(string("Could not open partition report file ") + partition_report);
+  bool csv = (partition_report.size() >= 4 && partition_report.compare(partition_report.size() - 4, 4, ".csv") == 0);
+
+  if (csv) {
+    out << "# grid " << fortran_vars.grid_type << ": " << cubes.size() << " cubes, " << spheres.size() << " spheres" << endl;
+    out << "# points " << total_points << " points*functions " << total_functions << " cost " << total_cost << " NCOxM " << nco_m << " MxM " << m_m << endl;
+    out << "# threads " << threads << " point loop imbalance";
+    for (uint i = 0; i < 4; i++) out << " " << point_phases[i] << " " << imbalance[i];
+    out << endl;
+    out << "# seconds per cost " << scale << " cost model error " << cost_error << endl;
+    write_histogram(out, "points", histogram(points), true);
+    write_histogram(out, "functions", histogram(functions), true);
+    write_histogram(out, "cost", histogram(costs), true);
+    out << "type,points,functions,cost,predicted,measured" << endl;
+    for (uint i = 0; i < groups.size(); i++)
+      out << groups[i].type << "," << groups[i].points << "," << groups[i].functions << "," << groups[i].cost << "," << groups[i].cost * scale << "," << groups[i].measured << endl;
+  }
+  else {
+    out << "{" << endl;
+    out << "  \"grid_type\": " << fortran_vars.grid_type << "," << endl;
+    out << "  \"cubes\": " << cubes.size() << ", \"spheres\": " << spheres.size() << "," << endl;
+    out << "  \"totals\": {\"points\": " << total_points << ", \"points_functions\": " << total_functions << ", \"cost\": " << total_cost
+        << ", \"nco_m\": " << nco_m << ", \"m_m\": " << m_m << ", \"time\": " << total_time << "}," << endl;
+    out << "  \"threads\": " << threads << "," << endl;
+    out << "  \"point_loop_imbalance\": {";
+    for (uint i = 0; i < 4; i++) out << (i == 0 ? "" : ", ") << "\"" << point_phases[i] << "\": " << imbalance[i];
+    out << "}," << endl;
+    out << "  \"seconds_per_cost\": " << scale << ", \"cost_model_error\": " << cost_error << "," << endl;
+    out << "  \"histograms\": {" << endl;
+    write_histogram(out, "points", histogram(points), false); out << "," << endl;
+    write_histogram(out, "functions", histogram(functions), false); out << "," << endl;
+    write_histogram(out, "cost", histogram(costs), false); out << endl;
+    out << "  }," << endl;
+    out << "  \"groups\": [" << endl;
+    for (uint i = 0; i < groups.size(); i++) {
+      out << "    {\"type\": \"" << groups[i].type << "\", \"points\": " << groups[i].points << ", \"functions\": " << groups[i].functions
+          << ", \"cost\": " << groups[i].cost << ", \"predicted\": " << groups[i].cost * scale << ", \"measured\": " << groups[i].measured << "}"
+          << (i + 1 == groups.size() ? "" : ",") << endl;
+    }
+    out << "  ]" << endl;
+    out << "}" << endl;
+  }
+
+  cout << "partition report written to " << partition_report << endl;
+}
+
+}
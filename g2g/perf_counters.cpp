@@ -0,0 +1,202 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "common.h"
+#include "init.h"
+#include "perf_counters.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#endif
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace G2G {
+
+#ifdef __linux__
+struct PerfEventType {
+  const char* name;
+  uint32_t type;
+  uint64_t config;
+  uint flops; // per counted instruction
+};
+
+#define FP_ARITH_INST_RETIRED(umask) ((umask << 8) | 0xc7)
+
+static const PerfEventType perf_event_types[PERF_EVENTS] = {
+  { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0 },
+  { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0 },
+  { "llc misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 0 },
+  { "fp scalar double", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x01), 1 },
+  { "fp scalar single", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x02), 1 },
+  { "fp 128 double", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x04), 2 },
+  { "fp 128 single", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x08), 4 },
+  { "fp 256 double", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x10), 4 },
+  { "fp 256 single", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x20), 8 },
+  { "fp 512 double", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x40), 8 },
+  { "fp 512 single", PERF_TYPE_RAW, FP_ARITH_INST_RETIRED(0x80), 16 },
+};
+
+/* file descriptors of each event of each OpenMP thread, -1 for the ones that could not be opened */
+static vector<int> perf_fds;
+static uint perf_threads = 0;
+static bool perf_failed = false;
+static bool fp_available = false;
+
+static int open_event(const PerfEventType& event, pid_t tid) {
+  perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = event.type;
+  attr.config = event.config;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  return syscall(__NR_perf_event_open, &attr, tid, -1, -1, 0);
+}
+
+/* the raw FP event codes are only meaningful on Intel processors */
+static bool intel_processor(void) {
+  ifstream cpuinfo("/proc/cpuinfo");
+  string line;
+  while (getline(cpuinfo, line)) {
+    if (line.compare(0, 9, "vendor_id") == 0) return line.find("GenuineIntel") != string::npos;
+  }
+  return false;
+}
+
+/* opens the counters of the threads of the current OpenMP team size, if it changed since the last time */
+static bool open_counters(void) {
+  if (perf_failed) return false;
+#ifdef _OPENMP
+  uint threads = omp_get_max_threads();
+#else
+  uint threads = 1;
+#endif
+  if (threads == perf_threads) return true;
+  perf_counters_close();
+
+  vector<pid_t> tids(threads);
+  #pragma omp parallel num_threads(threads)
+  {
+#ifdef _OPENMP
+    tids[omp_get_thread_num()] = syscall(SYS_gettid);
+#else
+    tids[0] = syscall(SYS_gettid);
+#endif
+  }
+
+  perf_fds.assign(threads * PERF_EVENTS, -1);
+  fp_available = intel_processor();
+  for (uint t = 0; t < threads; t++) {
+    for (uint e = 0; e < PERF_EVENTS; e++) {
+      if (perf_event_types[e].flops > 0 && !fp_available) continue;
+      perf_fds[t * PERF_EVENTS + e] = open_event(perf_event_types[e], tids[t]);
+      if (perf_fds[t * PERF_EVENTS + e] < 0) {
+        if (perf_event_types[e].flops == 0) {
+          cout << "perf_counters: could not open " << perf_event_types[e].name << " (" << strerror(errno)
+               << "), check /proc/sys/kernel/perf_event_paranoid" << endl;
+          perf_counters_close();
+          perf_failed = true;
+          return false;
+        }
+        fp_available = false;
+      }
+    }
+  }
+  if (!fp_available) cout << "perf_counters: floating point events not available on this processor, no GFLOP/s" << endl;
+
+  perf_threads = threads;
+  return true;
+}
+
+void perf_counters_close(void) {
+  for (uint i = 0; i < perf_fds.size(); i++) if (perf_fds[i] >= 0) close(perf_fds[i]);
+  perf_fds.clear();
+  perf_threads = 0;
+}
+
+/* counts of each event summed over the threads, scaled for the time the kernel multiplexed them out */
+static void read_counters(double* values) {
+  for (uint e = 0; e < PERF_EVENTS; e++) values[e] = 0;
+  for (uint t = 0; t < perf_threads; t++) {
+    for (uint e = 0; e < PERF_EVENTS; e++) {
+      int fd = perf_fds[t * PERF_EVENTS + e];
+      uint64_t data[3]; // value, time enabled, time running
+      if (fd < 0 || read(fd, data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+      values[e] += (double)data[0] * ((double)data[1] / data[2]);
+    }
+  }
+}
+#else
+void perf_counters_close(void) { }
+#endif
+
+PerfCounters::PerfCounters(void) : elapsed(0) {
+  for (uint e = 0; e < PERF_EVENTS; e++) values[e] = start_values[e] = 0;
+}
+
+void PerfCounters::start(void) {
+#ifdef __linux__
+  if (!perf_counters || !open_counters()) return;
+  read_counters(start_values);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+#endif
+}
+
+void PerfCounters::pause(void) {
+#ifdef __linux__
+  if (!perf_counters || perf_threads == 0) return;
+  timespec t1;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  double end_values[PERF_EVENTS];
+  read_counters(end_values);
+  for (uint e = 0; e < PERF_EVENTS; e++) values[e] += end_values[e] - start_values[e];
+  elapsed += (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) * 1e-9;
+#endif
+}
+
+bool PerfCounters::empty(void) const {
+  return values[PERF_CYCLES] == 0;
+}
+
+double PerfCounters::value(PerfEvent event) const {
+  return values[event];
+}
+
+double PerfCounters::flops(void) const {
+  double total = 0;
+#ifdef __linux__
+  if (!fp_available) return 0;
+  for (uint e = 0; e < PERF_EVENTS; e++) total += values[e] * perf_event_types[e].flops;
+#endif
+  return total;
+}
+
+double PerfCounters::seconds(void) const {
+  return elapsed;
+}
+
+std::ostream& operator<<(std::ostream& o, const PerfCounters& c) {
+  double cycles = c.value(PERF_CYCLES), bytes = c.value(PERF_LLC_MISSES) * 64, flops = c.flops();
+  o << "IPC " << (cycles > 0 ? c.value(PERF_INSTRUCTIONS) / cycles : 0);
+  if (flops > 0) o << " GFLOP/s " << flops / c.seconds() * 1e-9;
+  o << " GB/s " << (c.seconds() > 0 ? bytes / c.seconds() * 1e-9 : 0);
+  if (flops > 0) o << " bytes/flop " << bytes / flops;
+  o << " (cycles " << cycles << " instructions " << c.value(PERF_INSTRUCTIONS) << " llc misses " << c.value(PERF_LLC_MISSES);
+  if (flops > 0) o << " flops " << flops;
+  o << ")";
+  return o;
+}
+
+}
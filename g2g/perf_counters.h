@@ -0,0 +1,47 @@
+#ifndef __G2G_PERF_COUNTERS_H__
+#define __G2G_PERF_COUNTERS_H__
+
+#include <iostream>
+#include <time.h>
+
+namespace G2G {
+  enum PerfEvent {
+    PERF_CYCLES, PERF_INSTRUCTIONS, PERF_LLC_MISSES,
+    /* Intel FP_ARITH_INST_RETIRED, by vector width and precision */
+    PERF_FP_SCALAR_DOUBLE, PERF_FP_SCALAR_SINGLE, PERF_FP_128_DOUBLE, PERF_FP_128_SINGLE,
+    PERF_FP_256_DOUBLE, PERF_FP_256_SINGLE, PERF_FP_512_DOUBLE, PERF_FP_512_SINGLE,
+    PERF_EVENTS
+  };
+
+  /**
+   * Hardware counters of a phase (option perf_counters), read with perf_event_open and summed over the
+   * OpenMP threads. start and pause must be called outside parallel regions: they read the counters of
+   * every thread, so they are meant for whole phases, not for single points. Memory traffic is estimated
+   * as 64 bytes per last level cache miss, since the memory controller counters need system-wide access.
+   */
+  class PerfCounters {
+    public:
+      PerfCounters(void);
+
+      void start(void);
+      void pause(void);
+
+      bool empty(void) const;
+      double value(PerfEvent event) const;
+      double flops(void) const;     // 0 if the FP events are not available
+      double seconds(void) const;
+
+      friend std::ostream& operator<<(std::ostream& o, const PerfCounters& c);
+
+    private:
+      double values[PERF_EVENTS], start_values[PERF_EVENTS];
+      double elapsed;
+      timespec t0;
+  };
+
+  std::ostream& operator<<(std::ostream& o, const PerfCounters& c);
+
+  void perf_counters_close(void);
+}
+
+#endif
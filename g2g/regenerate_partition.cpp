@@ -1,12 +1,15 @@
 /* includes */
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #include <limits>
 #include <vector>
 
 #include "common.h"
 #include "init.h"
 #include "partition.h"
+#include "symmetry.h"
+#include "perf_counters.h"
 
 using namespace std;
 using namespace G2G;
@@ -15,19 +18,200 @@ using namespace G2G;
  * Construct partition
  ************************************************************/
 
-//Sorting the cubes in increasing order of size in bytes in GPU.
+/* Appends group to groups by swapping it in, leaving group empty. When the vector is full its elements
+ * are swapped into the grown storage, so no group (points, functions, tables) is ever copied */
 template <typename T>
-bool comparison_by_size(const T & a, const T & b) {
-    return a.size_in_gpu() < b.size_in_gpu();
+static void append_group(vector<T>& groups, T& group) {
+    if (groups.size() == groups.capacity()) {
+        vector<T> grown;
+        grown.reserve(max<size_t>(16, 2 * groups.capacity()));
+        grown.resize(groups.size());
+        for (size_t i = 0; i < groups.size(); i++) grown[i].swap(groups[i]);
+        groups.swap(grown);
+    }
+    groups.push_back(T());
+    groups.back().swap(group);
 }
+
+//Sorting the cubes in increasing order of size in bytes in GPU.
+//Only the (size, index) keys are sorted, the groups are then swapped into place.
 template <typename T>
 void sortBySize(std::vector<T>& input) {
-    sort(input.begin(), input.end(), comparison_by_size<T>);
+    vector<pair<size_t, size_t> > keys(input.size());
+    for (size_t i = 0; i < input.size(); i++) keys[i] = make_pair((size_t)input[i].size_in_gpu(), i);
+    sort(keys.begin(), keys.end());
+
+    vector<T> sorted(input.size());
+    for (size_t i = 0; i < keys.size(); i++) sorted[i].swap(input[keys[i].second]);
+    input.swap(sorted);
+}
+
+/* Splits the points of an atomic sphere into sphere_radial_slabs groups of consecutive shells and
+ * sphere_angular_sectors sectors around the atom, so that each batch keeps only its own significant functions */
+static void split_sphere(const Sphere& sphere, vector<Sphere>& batches)
+{
+    uint atom_shells = fortran_vars.shells(sphere.atom);
+    uint included_shells = (uint)ceil(sphere_radius * atom_shells);
+    uint first_shell = atom_shells - included_shells;
+    uint slabs = max(1u, min(sphere_radial_slabs, included_shells));
+    const double3& atom_position(fortran_vars.atom_positions(sphere.atom));
+
+    vector<Sphere> split(slabs * sphere_angular_sectors, Sphere(sphere.atom, sphere.radius));
+    for (vector<Point>::const_iterator p = sphere.points.begin(); p != sphere.points.end(); ++p)
+    {
+        uint slab = ((p->shell - first_shell) * slabs) / included_shells;
+        double3 rel_position = p->position - atom_position;
+        uint sector = 0;
+        if (sphere_angular_sectors >= 2 && rel_position.z < 0) sector |= 1;
+        if (sphere_angular_sectors >= 4 && rel_position.y < 0) sector |= 2;
+        if (sphere_angular_sectors >= 8 && rel_position.x < 0) sector |= 4;
+        split[slab * sphere_angular_sectors + sector].add_point(*p);
+    }
+
+    for (uint i = 0; i < split.size(); i++)
+    {
+        if (split[i].number_of_points != 0)
+            append_group(batches, split[i]);
+    }
+}
+
+/* fraction of the functions of either group that are shared by both */
+static double function_overlap(const vector<uint>& a, const vector<uint>& b)
+{
+    vector<uint> shared;
+    set_intersection(a.begin(), a.end(), b.begin(), b.end(), back_inserter(shared));
+    size_t total = a.size() + b.size() - shared.size();
+    return (total == 0 ? 1 : (double)shared.size() / total);
+}
+
+/* Grows batches of neighbouring cubes with less than cube_merge_points points, up to cube_merge_points points,
+ * as long as the function set of each added cube overlaps that of the batch by at least cube_merge_overlap.
+ * prism_cube maps each cell of the prism to its index in cubes (or -1). Cubes without a prism cell
+ * (the clusters of point_clustering) are kept as they are */
+static void merge_cubes(vector<Cube>& cubes, const vector<int>& prism_cube, const uint3& prism_size)
+{
+    static const int offsets[6][3] = { {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1} };
+
+    size_t points_before = 0;
+    for (uint i = 0; i < cubes.size(); i++) points_before += cubes[i].number_of_points;
+
+    vector<bool> merged(cubes.size(), false);
+    vector<Cube> batches;
+    for (uint cell = 0; cell < prism_cube.size(); cell++)
+    {
+        int seed = prism_cube[cell];
+        if (seed < 0 || merged[seed]) continue;
+        merged[seed] = true;
+
+        Cube batch;
+        batch.swap(cubes[seed]);
+        vector<uint> pending;
+        if (batch.number_of_points < cube_merge_points) pending.push_back(cell);
+
+        while (!pending.empty())
+        {
+            uint current = pending.back();
+            pending.pop_back();
+            int coord[3] = { (int)(current / (prism_size.y * prism_size.z)), (int)((current / prism_size.z) % prism_size.y), (int)(current % prism_size.z) };
+
+            for (uint n = 0; n < 6; n++)
+            {
+                int i = coord[0] + offsets[n][0], j = coord[1] + offsets[n][1], k = coord[2] + offsets[n][2];
+                if (i < 0 || j < 0 || k < 0 || i >= (int)prism_size.x || j >= (int)prism_size.y || k >= (int)prism_size.z) continue;
+
+                uint neighbour = (i * prism_size.y + j) * prism_size.z + k;
+                int other = prism_cube[neighbour];
+                if (other < 0 || merged[other]) continue;
+
+                const Cube& cube = cubes[other];
+                if (cube.number_of_points >= cube_merge_points || batch.number_of_points + cube.number_of_points > cube_merge_points) continue;
+                if (function_overlap(batch.local2global_func, cube.local2global_func) < cube_merge_overlap) continue;
+
+                batch.merge(cube);
+                merged[other] = true;
+                pending.push_back(neighbour);
+            }
+        }
+
+        append_group(batches, batch);
+    }
+
+    for (uint i = 0; i < cubes.size(); i++)
+    {
+        if (!merged[i]) append_group(batches, cubes[i]);
+    }
+
+    size_t points_after = 0;
+    for (uint i = 0; i < batches.size(); i++) points_after += batches[i].number_of_points;
+    if (points_after != points_before)
+        throw std::runtime_error("merge_cubes: the merged cubes do not have all the points");
+
+    cubes.swap(batches);
+}
+
+/* orders points along one coordinate axis */
+struct PointAxisLess {
+    PointAxisLess(uint _axis) : axis(_axis) {}
+    bool operator()(const Point& a, const Point& b) const { return elem(a.position, axis) < elem(b.position, axis); }
+    uint axis;
+};
+
+/* builds a cube group with the points in [first, last) and the functions significant in their bounding box */
+static void make_cluster(vector<Point>::const_iterator first, vector<Point>::const_iterator last,
+    const vector<double>& min_exps, const vector<double>& min_coeff, Cube& cluster)
+{
+    double3 box_min = first->position, box_max = first->position;
+    for (vector<Point>::const_iterator p = first; p != last; ++p)
+    {
+        box_min = make_double3(min(box_min.x, p->position.x), min(box_min.y, p->position.y), min(box_min.z, p->position.z));
+        box_max = make_double3(max(box_max.x, p->position.x), max(box_max.y, p->position.y), max(box_max.z, p->position.z));
+        cluster.add_point(*p);
+    }
+    cluster.assign_significative_functions(box_min, box_max, min_exps, min_coeff);
+}
+
+static double cluster_cost(const Cube& cluster)
+{
+    double m = cluster.total_functions();
+    return cluster.number_of_points * m * m;
+}
+
+/* Recursive bisection of the points in [first, last) into clusters of at most cluster_target_points points.
+ * Each split is done at the median of the axis whose halves have the smallest points * functions^2 cost */
+static void cluster_points(vector<Point>& points, size_t first, size_t last,
+    const vector<double>& min_exps, const vector<double>& min_coeff, vector<Cube>& clusters)
+{
+    if (last - first <= max(cluster_target_points, 1u))
+    {
+        Cube cluster;
+        make_cluster(points.begin() + first, points.begin() + last, min_exps, min_coeff, cluster);
+        append_group(clusters, cluster);
+        return;
+    }
+
+    size_t middle = first + (last - first) / 2;
+    uint best_axis = 0;
+    double best_cost = numeric_limits<double>::max();
+    for (uint axis = 0; axis < 3; axis++)
+    {
+        nth_element(points.begin() + first, points.begin() + middle, points.begin() + last, PointAxisLess(axis));
+        Cube left, right;
+        make_cluster(points.begin() + first, points.begin() + middle, min_exps, min_coeff, left);
+        make_cluster(points.begin() + middle, points.begin() + last, min_exps, min_coeff, right);
+
+        double cost = cluster_cost(left) + cluster_cost(right);
+        if (cost < best_cost) { best_cost = cost; best_axis = axis; }
+    }
+
+    nth_element(points.begin() + first, points.begin() + middle, points.begin() + last, PointAxisLess(best_axis));
+    cluster_points(points, first, middle, min_exps, min_coeff, clusters);
+    cluster_points(points, middle, last, min_exps, min_coeff, clusters);
 }
 
 /* methods */
 void Partition::regenerate(void)
 {
+    PerfCounters weights_counters;
 //	cout << "<============ G2G Partition (" << fortran_vars.grid_type << ")============>" << endl;
 
     // Determina el exponente minimo para cada tipo de atomo.
@@ -95,7 +279,10 @@ void Partition::regenerate(void)
     uint3 prism_size = ceil_uint3((x1 - x0) / little_cube_size);
 
     vector<vector<vector<Cube> > >
-      prism(prism_size.x, vector<vector<Cube> >(prism_size.y, vector<Cube>(prism_size.z)));
+      prism(point_clustering ? 0 : prism_size.x, vector<vector<Cube> >(prism_size.y, vector<Cube>(prism_size.z)));
+
+    // Con point_clustering los puntos que no van a esferas se agrupan por biseccion en vez de cubos.
+    vector<Point> cluster_point_list;
 
     // Inicializamos las esferas.
     vector<Sphere> sphere_array;
@@ -141,11 +328,32 @@ void Partition::regenerate(void)
         fortran_vars.nearest_neighbor_dists(i) = nearest_neighbor_dist;
     }
 
+    // Envolvente de las funciones de cada atomo: C * max(1,d)^L * exp(-a_min d^2) acota la suma de sus |funciones|.
+    vector<double> envelope_coeff(fortran_vars.atoms, 0);
+    vector<double> envelope_exp(fortran_vars.atoms, numeric_limits<double>::max());
+    vector<uint> envelope_l(fortran_vars.atoms, 0);
+    if (cull_points_tolerance > 0)
+    {
+        for (uint i = 0; i < fortran_vars.m; i++)
+        {
+            uint nuc = fortran_vars.nucleii(i) - 1;
+            uint l = (i < fortran_vars.s_funcs ? 0 : (i < fortran_vars.s_funcs + fortran_vars.p_funcs * 3 ? 1 : 2));
+            for (uint j = 0; j < fortran_vars.contractions(i); j++)
+            {
+                envelope_coeff[nuc] += fabs(fortran_vars.c_values(i, j));
+                envelope_exp[nuc] = min(envelope_exp[nuc], fortran_vars.a_values(i, j));
+            }
+            envelope_l[nuc] = max(envelope_l[nuc], l);
+        }
+    }
+    uint puntos_descartados = 0;
+
+    // Buscamos las simetrias de la molecula, para integrar solo los puntos no equivalentes.
+    if (use_symmetry) symmetry.detect();
+    else symmetry.clear();
+
     // Computamos los puntos y los asignamos a los cubos y esferas.
     uint puntos_totales = 0;
-    uint puntos_finales = 0;
-    uint funciones_finales = 0;
-    uint costo = 0;
 
     // Limpiamos las colecciones de las esferas y cubos que tengamos guardadas.
     this->clear();
@@ -170,6 +378,9 @@ void Partition::regenerate(void)
 
             for (uint point = 0; point < (uint)fortran_vars.grid_size; point++)
             {
+                uint multiplicity = 1;
+                if (!symmetry.is_unique(atom, point, multiplicity)) continue;
+
                 double3 rel_point_position = make_double3(fortran_vars.e(point,0), fortran_vars.e(point,1), fortran_vars.e(point,2));
                 double3 point_position = atom_position + rel_point_position * r1;
                 bool inside_prism = ((x0.x <= point_position.x && point_position.x <= x1.x) &&
@@ -177,7 +388,25 @@ void Partition::regenerate(void)
                                      (x0.z <= point_position.z && point_position.z <= x1.z));
                 if (inside_prism)
                 {
-                    double point_weight = wrad * fortran_vars.wang(point); // integration weight
+                    double point_weight = wrad * fortran_vars.wang(point) * multiplicity; // integration weight
+
+                    // Descartamos los puntos donde ninguna funcion puede aportar densidad apreciable.
+                    if (cull_points_tolerance > 0)
+                    {
+                        double envelope = 0;
+                        for (uint i = 0; i < fortran_vars.atoms; i++)
+                        {
+                            if (envelope_coeff[i] == 0) continue;
+                            double d2 = length2(point_position - fortran_vars.atom_positions(i));
+                            envelope += envelope_coeff[i] * pow(max(1.0, sqrt(d2)), (int)envelope_l[i]) * exp(-envelope_exp[i] * d2);
+                        }
+                        if (point_weight * cull_density_bound * envelope * envelope < cull_points_tolerance)
+                        {
+                            puntos_descartados++;
+                            continue;
+                        }
+                    }
+
                     Point point_object(atom, shell, point, point_position, point_weight);
                     uint included_shells = (uint)ceil(sphere_radius * atom_shells);
 
@@ -188,6 +417,10 @@ void Partition::regenerate(void)
                         Sphere& sphere = sphere_array[atom];
                         sphere.add_point(point_object);
                     }
+                    else if (point_clustering)
+                    {
+                        cluster_point_list.push_back(point_object);
+                    }
                     else
                     {
                         // Insertamos este punto en el cubo correspondiente.
@@ -201,13 +434,36 @@ void Partition::regenerate(void)
         }
     }
 
+    if (cull_points_tolerance > 0)
+        cout << "cull_points: " << puntos_descartados << " of " << puntos_totales << " points dropped" << endl;
+
     // La grilla computada ahora tiene |puntos_totales| puntos, y |fortran_vars.m| funciones.
-    uint nco_m = 0;
-    uint m_m = 0;
+    vector<int> prism_cube(prism_size.x * prism_size.y * prism_size.z, -1);
+
+    // Agrupamos los puntos en clusters y los agregamos a la particion.
+    if (point_clustering && !cluster_point_list.empty())
+    {
+        vector<Cube> clusters;
+        cluster_points(cluster_point_list, 0, cluster_point_list.size(), min_exps_func, min_coeff_func, clusters);
+
+        for (uint i = 0; i < clusters.size(); i++)
+        {
+            Cube& cube = clusters[i];
+            if (cube.total_functions_simple() == 0 || cube.number_of_points < min_points_per_cube)
+                continue;
+
+            weights_counters.start();
+            cube.compute_weights();
+            weights_counters.pause();
+            if (cube.number_of_points < min_points_per_cube)
+                continue;
+
+            append_group(cubes, cube);
+        }
+    }
 
-    puntos_finales = 0;
     // Completamos los parametros de los cubos y los agregamos a la particion.
-    for (uint i = 0; i < prism_size.x; i++)
+    for (uint i = 0; i < prism.size(); i++)
     {
         for (uint j = 0; j < prism_size.y; j++)
         {
@@ -223,39 +479,51 @@ void Partition::regenerate(void)
                 if (cube_ijk.number_of_points < min_points_per_cube) // Este cubo no tiene suficientes puntos.
                     continue;
 
-                Cube cube(cube_ijk);
-                assert(cube.number_of_points != 0);
-                cube.compute_weights();
+                assert(cube_ijk.number_of_points != 0);
+                weights_counters.start();
+                cube_ijk.compute_weights();
+                weights_counters.pause();
 
-                if (cube.number_of_points < min_points_per_cube)
+                if (cube_ijk.number_of_points < min_points_per_cube)
                 {
                     cout << "not enough points" << endl;
                     continue;
                 }
-                cubes.push_back(cube);
+                append_group(cubes, cube_ijk);
+                prism_cube[(i * prism_size.y + j) * prism_size.z + k] = cubes.size() - 1;
 
                 // para hacer histogramas
 //#ifdef HISTOGRAM
                 //cout << "[" << fortran_vars.grid_type << "] cubo: (" << i << "," << j << "," << k << "): " << cube.number_of_points << " puntos; " <<
                      //cube.total_functions() << " funciones, vecinos: " << cube.total_nucleii() << endl;
 //#endif
-
-                puntos_finales += cube.number_of_points;
-                funciones_finales += cube.number_of_points * cube.total_functions();
-                costo += cube.number_of_points * (cube.total_functions() * cube.total_functions());
-                nco_m += cube.total_functions() * fortran_vars.nco;
-                m_m += cube.total_functions() * cube.total_functions();
             }
         }
     }
+
+    // Juntamos cubos vecinos con pocos puntos y funciones similares.
+    if (cube_merge_points > 0)
+        merge_cubes(cubes, prism_cube, prism_size);
     sortBySize<Cube>(cubes);
 
     // Si esta habilitada la particion en esferas, entonces clasificamos y las agregamos a la particion tambien.
     if (sphere_radius > 0)
     {
+        vector<Sphere> sphere_batches;
         for (uint i = 0; i < fortran_vars.atoms; i++)
         {
-            Sphere& sphere_i = sphere_array[i];
+            // with use_symmetry all the points of an atom may be images of another one's
+            if (sphere_array[i].number_of_points == 0)
+                continue;
+            if (sphere_radial_slabs > 1 || sphere_angular_sectors > 1)
+                split_sphere(sphere_array[i], sphere_batches);
+            else
+                append_group(sphere_batches, sphere_array[i]);
+        }
+
+        for (uint i = 0; i < sphere_batches.size(); i++)
+        {
+            Sphere& sphere_i = sphere_batches[i];
 
             assert(sphere_i.number_of_points != 0);
 
@@ -267,28 +535,22 @@ void Partition::regenerate(void)
                 continue;
             }
 
-            Sphere sphere(sphere_i);
-            assert(sphere.number_of_points != 0);
-            sphere.compute_weights();
-            if (sphere.number_of_points < min_points_per_cube)
+            weights_counters.start();
+            sphere_i.compute_weights();
+            weights_counters.pause();
+            if (sphere_i.number_of_points < min_points_per_cube)
             {
                 cout << "not enough points" << endl;
                 continue;
             }
-            assert(sphere.number_of_points != 0);
-            spheres.push_back(sphere);
+            assert(sphere_i.number_of_points != 0);
+            append_group(spheres, sphere_i);
 
 //#ifdef HISTOGRAM
             //cout << "sphere: " << sphere.number_of_points << " puntos, " << sphere.total_functions() <<
                 // " funciones | funcion x punto: " << sphere.total_functions() / (double)sphere.number_of_points <<
                 // " vecinos: " << sphere.total_nucleii() << endl;
 //#endif
-
-            puntos_finales += sphere.number_of_points;
-            funciones_finales += sphere.number_of_points * sphere.total_functions();
-            costo += sphere.number_of_points * (sphere.total_functions() * sphere.total_functions());
-            nco_m += sphere.total_functions() * fortran_vars.nco;
-            m_m += sphere.total_functions() * sphere.total_functions();
         }
     }
     //Sorting the spheres in increasing order
@@ -298,8 +560,9 @@ void Partition::regenerate(void)
     //If it is CPU, then this doesn't matter
     globalMemoryPool::init(G2G::free_global_memory);
 
-    //cout << "Grilla final: " << puntos_finales << " puntos (recordar que los de peso 0 se tiran), " << funciones_finales << " funciones" << endl ;
-    //cout << "Costo: " << costo << endl;
-    //cout << "NCOxM: " << nco_m << " MxM: " << m_m << endl;
-    //cout << "Particion final: " << spheres.size() << " esferas y " << cubes.size() << " cubos" << endl;
+    if (!weights_counters.empty()) cout << "weights: " << weights_counters << endl;
+    account_storage();
+
+    // El reporte (puntos, funciones, costo por grupo) se escribe luego del proximo solve, con los tiempos medidos.
+    report_pending = !partition_report.empty();
 }
@@ -0,0 +1,183 @@
+#include <iostream>
+#include <vector>
+#include <cmath>
+#include <algorithm>
+#include "common.h"
+#include "init.h"
+#include "matrix.h"
+#include "symmetry.h"
+using namespace std;
+
+namespace G2G {
+Symmetry symmetry;
+
+#define SYMMETRY_TOLERANCE 1e-6
+
+/* shell type (0: s, 1: p, 2: d) of a function */
+static uint function_type(uint func) {
+  if (func < fortran_vars.s_funcs) return 0;
+  else if (func < fortran_vars.s_funcs + fortran_vars.p_funcs * 3) return 1;
+  else return 2;
+}
+
+static uint function_size(uint type) {
+  return (type == 0 ? 1 : (type == 1 ? 3 : fortran_vars.d_components));
+}
+
+/* sign picked up by a component of a shell when the coordinates are multiplied by sign */
+static int component_sign(uint type, uint component, const int* sign) {
+  static const uint cartesian_d[6][2] = { {0,0}, {0,1}, {1,1}, {0,2}, {1,2}, {2,2} }; // xx, xy, yy, xz, yz, zz
+  static const uint spherical_d[5][2] = { {0,1}, {1,2}, {0,0}, {0,2}, {0,0} }; // xy, yz, z2, xz, x2-y2
+
+  if (type == 0) return 1;
+  else if (type == 1) return sign[component];
+  else if (fortran_vars.d_components == 6) return sign[cartesian_d[component][0]] * sign[cartesian_d[component][1]];
+  else return sign[spherical_d[component][0]] * sign[spherical_d[component][1]];
+}
+
+static bool same_value(double a, double b) {
+  return fabs(a - b) <= SYMMETRY_TOLERANCE * max(1.0, max(fabs(a), fabs(b)));
+}
+
+/* index of element (i,j) in a packed upper triangle of fortran_vars.m x fortran_vars.m */
+static uint packed_index(uint i, uint j) {
+  if (i > j) swap(i, j);
+  return (i * fortran_vars.m - (i * (i - 1)) / 2) + (j - i);
+}
+
+bool Symmetry::build_operation(const double3& centroid, Operation& op) const {
+  /* atoms */
+  op.atom_map.resize(fortran_vars.atoms);
+  for (uint i = 0; i < fortran_vars.atoms; i++) {
+    double3 rel_position = fortran_vars.atom_positions(i) - centroid;
+    double3 image = centroid + make_double3(op.sign[0] * rel_position.x, op.sign[1] * rel_position.y, op.sign[2] * rel_position.z);
+
+    uint j = 0;
+    while (j < fortran_vars.atoms && (fortran_vars.atom_types(j) != fortran_vars.atom_types(i) ||
+           length(fortran_vars.atom_positions(j) - image) > SYMMETRY_TOLERANCE)) j++;
+    if (j == fortran_vars.atoms) return false;
+    op.atom_map[i] = j;
+  }
+
+  /* angular grid */
+  op.point_map.resize(fortran_vars.grid_size);
+  for (uint i = 0; i < (uint)fortran_vars.grid_size; i++) {
+    uint j = 0;
+    while (j < (uint)fortran_vars.grid_size &&
+           !(same_value(fortran_vars.e(j,0), op.sign[0] * fortran_vars.e(i,0)) && same_value(fortran_vars.e(j,1), op.sign[1] * fortran_vars.e(i,1)) &&
+             same_value(fortran_vars.e(j,2), op.sign[2] * fortran_vars.e(i,2)) && same_value(fortran_vars.wang(j), fortran_vars.wang(i)))) j++;
+    if (j == (uint)fortran_vars.grid_size) return false;
+    op.point_map[i] = j;
+  }
+
+  /* basis functions: the k-th shell of each type of an atom maps to the k-th shell of that type of its image */
+  vector< vector<uint> > shells(fortran_vars.atoms * 3);
+  for (uint func = 0; func < fortran_vars.m; func += function_size(function_type(func)))
+    shells[(fortran_vars.nucleii(func) - 1) * 3 + function_type(func)].push_back(func);
+
+  op.func_map.resize(fortran_vars.m);
+  op.func_sign.resize(fortran_vars.m);
+  for (uint i = 0; i < fortran_vars.atoms; i++) {
+    for (uint type = 0; type < 3; type++) {
+      const vector<uint>& source = shells[i * 3 + type];
+      const vector<uint>& target = shells[op.atom_map[i] * 3 + type];
+      if (source.size() != target.size()) return false;
+
+      for (uint k = 0; k < source.size(); k++) {
+        uint contractions = fortran_vars.contractions(source[k]);
+        if (fortran_vars.contractions(target[k]) != contractions) return false;
+        for (uint c = 0; c < contractions; c++) {
+          if (!same_value(fortran_vars.a_values(source[k], c), fortran_vars.a_values(target[k], c)) ||
+              !same_value(fortran_vars.c_values(source[k], c), fortran_vars.c_values(target[k], c))) return false;
+        }
+
+        for (uint component = 0; component < function_size(type); component++) {
+          op.func_map[source[k] + component] = target[k] + component;
+          op.func_sign[source[k] + component] = component_sign(type, component, op.sign);
+        }
+      }
+    }
+  }
+
+  return true;
+}
+
+void Symmetry::detect(void) {
+  operations.clear();
+
+  double3 centroid = make_double3(0,0,0);
+  for (uint i = 0; i < fortran_vars.atoms; i++) centroid = centroid + fortran_vars.atom_positions(i);
+  centroid = centroid / (double)fortran_vars.atoms;
+
+  // the valid reflections are closed under composition, so they already form a group
+  vector<Operation> found;
+  for (uint flips = 0; flips < 8; flips++) {
+    Operation op;
+    for (uint k = 0; k < 3; k++) op.sign[k] = ((flips >> k) & 1 ? -1 : 1);
+    if (build_operation(centroid, op)) found.push_back(op);
+  }
+
+  if (found.size() > 1) operations.swap(found);
+  cout << "symmetry: " << max(order(), 1u) << " operations" << endl;
+}
+
+bool Symmetry::is_unique(uint atom, uint point, uint& multiplicity) const {
+  multiplicity = 1;
+  if (operations.empty()) return true;
+
+  pair<uint, uint> self(atom, point);
+  vector< pair<uint, uint> > images;
+  for (uint i = 0; i < operations.size(); i++) {
+    pair<uint, uint> image(operations[i].atom_map[atom], operations[i].point_map[point]);
+    if (image < self) return false;
+    images.push_back(image);
+  }
+
+  sort(images.begin(), images.end());
+  multiplicity = unique(images.begin(), images.end()) - images.begin();
+  return true;
+}
+
+void Symmetry::save(const FortranMatrix<double>& source, vector<double>& before) const {
+  before.resize(source.width * source.height);
+  for (uint j = 0; j < source.height; j++) {
+    for (uint i = 0; i < source.width; i++) before[j * source.width + i] = source(i, j);
+  }
+}
+
+void Symmetry::symmetrize_matrix(FortranMatrix<double>& target, const vector<double>& before) const {
+  vector<double> delta(before.size());
+  for (uint k = 0; k < delta.size(); k++) delta[k] = target(k) - before[k];
+
+  for (uint i = 0; i < fortran_vars.m; i++) {
+    for (uint j = i; j < fortran_vars.m; j++) {
+      double sum = 0;
+      for (uint g = 0; g < operations.size(); g++) {
+        const Operation& op = operations[g];
+        sum += op.func_sign[i] * op.func_sign[j] * delta[packed_index(op.func_map[i], op.func_map[j])];
+      }
+      uint k = packed_index(i, j);
+      target(k) = before[k] + sum / operations.size();
+    }
+  }
+}
+
+void Symmetry::symmetrize_forces(FortranMatrix<double>& forces, const vector<double>& before) const {
+  vector<double> delta(before.size());
+  for (uint k = 0; k < 3; k++) {
+    for (uint i = 0; i < fortran_vars.atoms; i++) delta[k * fortran_vars.atoms + i] = forces(i, k) - before[k * fortran_vars.atoms + i];
+  }
+
+  for (uint k = 0; k < 3; k++) {
+    for (uint i = 0; i < fortran_vars.atoms; i++) {
+      double sum = 0;
+      for (uint g = 0; g < operations.size(); g++) {
+        const Operation& op = operations[g];
+        sum += op.sign[k] * delta[k * fortran_vars.atoms + op.atom_map[i]];
+      }
+      forces(i, k) = before[k * fortran_vars.atoms + i] + sum / operations.size();
+    }
+  }
+}
+
+}
@@ -0,0 +1,46 @@
+#ifndef __G2G_SYMMETRY_H__
+#define __G2G_SYMMETRY_H__
+
+#include <vector>
+#include "init.h"
+#include "matrix.h"
+
+namespace G2G {
+  /**
+   * Reflections through the coordinate planes about the centroid of the molecule (the subgroup of D2h
+   * in the input orientation) that map the atoms, their basis functions and the angular grid onto themselves.
+   * Only one point of each orbit of the grid is integrated, weighted by the size of the orbit; the Fock
+   * matrix and forces are then averaged over the group. This assumes a density with the same symmetry.
+   */
+  class Symmetry {
+    public:
+      void detect(void);
+      void clear(void) { operations.clear(); }
+      uint order(void) const { return operations.size(); }
+
+      // true when the point (atom, angular point) is the representative of its orbit, which has multiplicity points
+      bool is_unique(uint atom, uint point, uint& multiplicity) const;
+
+      // copies source, to be passed as before below
+      void save(const FortranMatrix<double>& source, std::vector<double>& before) const;
+      // averages over the group the change of target (packed upper triangle of m x m) since before was taken
+      void symmetrize_matrix(FortranMatrix<double>& target, const std::vector<double>& before) const;
+      // idem for the forces (atoms x 3)
+      void symmetrize_forces(FortranMatrix<double>& forces, const std::vector<double>& before) const;
+
+    private:
+      struct Operation {
+        int sign[3];
+        std::vector<uint> atom_map, point_map, func_map;
+        std::vector<int> func_sign;
+      };
+
+      bool build_operation(const double3& centroid, Operation& op) const;
+
+      std::vector<Operation> operations; // includes the identity, empty if there is no symmetry
+  };
+
+  extern Symmetry symmetry;
+}
+
+#endif
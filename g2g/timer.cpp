@@ -1,9 +1,19 @@
 #include <cstdio>
+#include <cstdlib>
+#include <new>
 #include <time.h>
 #include <sys/time.h>
 #include <map>
+#include <vector>
+#include <deque>
+#include <algorithm>
 #include <string>
 #include "timer.h"
+#include "trace.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 // Only include it to sync timings in cuda threads.
 #include "cuda_includes.h"
@@ -134,38 +144,225 @@ void Timer::print(void) {
 #endif
 }
 
+/**** per thread timers ****/
+ThreadTimer::ThreadTimer(void) : slots(NULL), slot_count(0) {
+#ifdef TIMINGS
+#ifdef _OPENMP
+  slot_count = omp_get_max_threads();
+#else
+  slot_count = 1;
+#endif
+  void* memory;
+  if (posix_memalign(&memory, 64, slot_count * sizeof(Slot)) != 0) throw std::bad_alloc();
+  slots = (Slot*)memory;
+  for (unsigned int i = 0; i < slot_count; i++) {
+    timerspecclear(&slots[i].t0);
+    timerspecclear(&slots[i].res);
+    slots[i].count = 0;
+  }
+#endif
+}
+
+ThreadTimer::~ThreadTimer(void) {
+  free(slots);
+}
+
+static inline unsigned int thread_slot(void) {
+#ifdef _OPENMP
+  return omp_get_thread_num();
+#else
+  return 0;
+#endif
+}
+
+/* teams larger than the default one (explicit num_threads) only time their first slot_count threads */
+void ThreadTimer::start(void) {
+#ifdef TIMINGS
+  unsigned int thread = thread_slot();
+  if (thread < slot_count) clock_gettime(CLOCK_MONOTONIC, &slots[thread].t0);
+#endif
+}
+
+void ThreadTimer::pause(void) {
+#ifdef TIMINGS
+  unsigned int thread = thread_slot();
+  if (thread >= slot_count) return;
+  Slot& slot = slots[thread];
+  timespec t1, partial_res;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  timerspecsub(&t1, &slot.t0, &partial_res);
+  timerspecadd(&slot.res, &partial_res, &slot.res);
+  slot.count++;
+#endif
+}
+
+Timer ThreadTimer::total(void) const {
+  timespec res;
+  timerspecclear(&res);
+  for (unsigned int i = 0; i < slot_count; i++) timerspecadd(&res, &slots[i].res, &res);
+  return Timer(res);
+}
+
+Timer ThreadTimer::max(void) const {
+  Timer slowest;
+  for (unsigned int i = 0; i < slot_count; i++) {
+    Timer t(slots[i].res);
+    if (slowest < t) slowest = t;
+  }
+  return slowest;
+}
+
+unsigned int ThreadTimer::active_threads(void) const {
+  unsigned int active = 0;
+  for (unsigned int i = 0; i < slot_count; i++) if (slots[i].count > 0) active++;
+  return active;
+}
+
+double ThreadTimer::imbalance(void) const {
+  Timer sum = total(), slowest = max();
+  double sum_us = sum.getSec() * 1e6 + sum.getMicrosec();
+  double max_us = slowest.getSec() * 1e6 + slowest.getMicrosec();
+  if (sum_us == 0) return 1.0;
+  return max_us * active_threads() / sum_us;
+}
+
+std::ostream& G2G::operator<<(std::ostream& o, const ThreadTimer& t) {
+#ifdef TIMINGS
+  o << t.total() << " (max " << t.max() << " imbalance " << t.imbalance() << ")";
+#else
+  o << "[TIMINGS NOT ENABLED]";
+#endif
+  return o;
+}
+
 /**** to be used by fortran ****/
-Timer global_timer;
-map<string, Timer> fortran_timers;
+/* The Fortran timers form a tree that follows their nesting: a timer started while "SCF" runs is a child
+   of it, so the same name under two parents gives two nodes. Each node keeps its call count and the
+   total, min and max of its intervals, and the whole tree is printed once by g2g_deinit. Names are
+   interned: each call site passes the same literal, so the usual lookup compares its address only. */
+struct FortranTimer {
+  FortranTimer(unsigned int _name, int _parent) : name(_name), parent(_parent), calls(0), total(0), min(0), max(0) { timerspecclear(&t0); }
+
+  unsigned int name;
+  int parent;
+  vector<int> children;
+  unsigned long calls;
+  double total, min, max;
+  timespec t0;
+};
+
+static deque<string> timer_names; // a deque keeps the traced c_str() valid as it grows
+static map<string, unsigned int> timer_name_ids;
+static map<pair<const char*, unsigned int>, unsigned int> timer_literal_ids;
+static const unsigned int root_timer_name = ~0u; // not an interned name, so the root never matches a timer
+static vector<FortranTimer> timer_tree(1, FortranTimer(root_timer_name, -1));
+static vector<int> running_timers(1, 0); // path from the root to the innermost running timer
+
+#ifdef TIMINGS
+static unsigned int intern_timer_name(const char* timer_name, unsigned int length) {
+  pair<const char*, unsigned int> literal(timer_name, length);
+  map<pair<const char*, unsigned int>, unsigned int>::const_iterator it = timer_literal_ids.find(literal);
+  if (it != timer_literal_ids.end()) return it->second;
+
+  string name(timer_name, length);
+  map<string, unsigned int>::const_iterator named = timer_name_ids.find(name);
+  unsigned int id;
+  if (named != timer_name_ids.end()) id = named->second;
+  else {
+    id = timer_names.size();
+    timer_names.push_back(name);
+    timer_name_ids[name] = id;
+  }
+  // names copied to temporaries by the caller would fill the cache with addresses that are never seen again
+  if (timer_literal_ids.size() > 4096) timer_literal_ids.clear();
+  timer_literal_ids[literal] = id;
+  return id;
+}
+#endif
+
+/* closes the running timers from the innermost one up to the one at the given depth */
+static void close_timers(unsigned int depth) {
+  timespec t1, elapsed;
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  while (running_timers.size() > depth) {
+    FortranTimer& timer = timer_tree[running_timers.back()];
+    timerspecsub(&t1, &timer.t0, &elapsed);
+    double seconds = elapsed.tv_sec + elapsed.tv_nsec * 1e-9;
+    timer.min = (timer.calls == 0 ? seconds : std::min(timer.min, seconds));
+    timer.max = std::max(timer.max, seconds);
+    timer.total += seconds;
+    timer.calls++;
+    trace_end(timer_names[timer.name].c_str());
+    running_timers.pop_back();
+  }
+}
+
+#ifdef TIMINGS
+/* depth of the running timer with this name, 0 if it isn't running */
+static unsigned int running_depth(unsigned int name) {
+  for (unsigned int depth = running_timers.size() - 1; depth > 0; depth--) {
+    if (timer_tree[running_timers[depth]].name == name) return depth;
+  }
+  return 0;
+}
+#endif
+
+static void print_fortran_timer(int node, unsigned int level) {
+  const FortranTimer& timer = timer_tree[node];
+  string label = string(2 * level, ' ') + timer_names[timer.name];
+  printf("TIMER %-40s %8lu %12.6f %12.6f %12.6f %12.6f\n", label.c_str(), timer.calls, timer.total, timer.min,
+    timer.total / timer.calls, timer.max);
+  for (unsigned int i = 0; i < timer.children.size(); i++) print_fortran_timer(timer.children[i], level + 1);
+}
+
+void G2G::print_fortran_timers(void) {
+  if (timer_tree.size() == 1) return;
+  close_timers(1);
+
+  printf("TIMER %-40s %8s %12s %12s %12s %12s\n", "[seconds]", "calls", "total", "min", "mean", "max");
+  const FortranTimer& root = timer_tree[0];
+  for (unsigned int i = 0; i < root.children.size(); i++) print_fortran_timer(root.children[i], 0);
+  fflush(stdout);
+}
 
 extern "C" void g2g_timer_start_(const char* timer_name, unsigned int length_arg) {
 #ifdef TIMINGS
-  string tname(timer_name,length_arg);
-  tname.append("\0");
-  if (fortran_timers.find(tname) == fortran_timers.end()) fortran_timers[tname] = Timer();
+  unsigned int name = intern_timer_name(timer_name, length_arg);
   Timer::sync();
-  fortran_timers[tname].start();
+
+  // started again without being stopped: that closes its previous interval
+  unsigned int depth = running_depth(name);
+  if (depth > 0) close_timers(depth);
+
+  int parent = running_timers.back();
+  int node = -1;
+  const vector<int>& children = timer_tree[parent].children;
+  for (unsigned int i = 0; i < children.size() && node < 0; i++) {
+    if (timer_tree[children[i]].name == name) node = children[i];
+  }
+  if (node < 0) {
+    node = timer_tree.size();
+    timer_tree.push_back(FortranTimer(name, parent));
+    timer_tree[parent].children.push_back(node);
+  }
+
+  running_timers.push_back(node);
+  trace_begin(timer_names[name].c_str());
+  clock_gettime(CLOCK_MONOTONIC, &timer_tree[node].t0);
 #endif
 }
 
+/* stopping a timer also closes the ones started inside it that are still running; stopping one that
+   isn't running does nothing */
 extern "C" void g2g_timer_stop_(const char* timer_name, unsigned int length_arg) {
 #ifdef TIMINGS
-  string tname(timer_name, length_arg);
-  tname.append("\0");
+  unsigned int name = intern_timer_name(timer_name, length_arg);
   Timer::sync();
-  if (fortran_timers.find(tname) == fortran_timers.end()) cout << "no existe timer! (" << tname << ")" << endl;
-  fortran_timers[tname].stop();
-  cout << "TIMER [" << tname << "]: " << fortran_timers[tname] << endl;
+  unsigned int depth = running_depth(name);
+  if (depth > 0) close_timers(depth);
 #endif
 }
 
 extern "C" void g2g_timer_pause_(const char* timer_name, unsigned int length_arg) {
-#ifdef TIMINGS
-  string tname(timer_name, length_arg);
-  tname.append("\0");
-  Timer::sync();
-  if (fortran_timers.find(tname) == fortran_timers.end()) cout << "no existe timer! (" << tname << ")" << endl;
-  fortran_timers[tname].pause();
-  cout << "TIMER [" << tname << "]: " << fortran_timers[tname] << "(so far)" << endl;
-#endif
+  g2g_timer_stop_(timer_name, length_arg);
 }
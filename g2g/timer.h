@@ -2,6 +2,7 @@
 #define __TIMER_H__
 
 #include <iostream>
+#include <time.h>
 
 namespace G2G {
 	class Timer {
@@ -37,6 +38,43 @@ namespace G2G {
 	};
 
 	std::ostream& operator<<(std::ostream& o, const Timer& t);
+
+  /* Timer for phases run inside OpenMP parallel regions: each thread starts and pauses its own slot
+     (one cache line each, so threads don't share them). The sum over threads, the slowest thread and the
+     imbalance (slowest / mean of the threads that did work) are reported. */
+  class ThreadTimer {
+    public:
+      ThreadTimer(void);
+      ~ThreadTimer(void);
+
+      void start(void);
+      void pause(void);
+
+      Timer total(void) const;
+      Timer max(void) const;
+      double imbalance(void) const;
+      unsigned int active_threads(void) const;
+
+      friend std::ostream& operator<<(std::ostream& o, const ThreadTimer& t);
+
+    private:
+      struct Slot {
+        timespec t0, res;
+        unsigned long count;
+        char padding[64 - 2 * sizeof(timespec) - sizeof(unsigned long)];
+      };
+
+      Slot* slots;
+      unsigned int slot_count;
+
+      ThreadTimer(const ThreadTimer&);
+      ThreadTimer& operator=(const ThreadTimer&);
+  };
+
+  std::ostream& operator<<(std::ostream& o, const ThreadTimer& t);
+
+  // summary of the timers of the Fortran code (g2g_timer_start/stop), printed by g2g_deinit
+  void print_fortran_timers(void);
 }
 
 
@@ -0,0 +1,241 @@
+#!/usr/bin/env python2.7
+"""
+Writes synthetic g2g captures (see capture.h) of systems of any size, to be run with the replay tool:
+
+  water N:  N water molecules on a cubic lattice
+  alkane N: linear alkane with N carbons (C_N H_2N+2)
+  metal N:  N octahedral M(H2O)6 complexes on a line
+
+H, C, N and O use STO-3G; the metal uses a synthetic STO-3G-like iron basis (s, p and d shells).
+The angular grids and radial parameters are the same as the ones LIO builds (lioamber/grid.f).
+The density is diagonal, with the electrons of each atom spread over its functions, so it is only
+meant for timing: the captured energies are 0.
+"""
+
+from __future__ import print_function
+
+import argparse
+import itertools
+import math
+import struct
+
+BOHR = 0.529177
+MAX_CONTRACTIONS = 7
+CAPTURE_MAGIC = b"G2GCAP1\0"
+CAPTURE_PARAMETERS, CAPTURE_POSITIONS, CAPTURE_SOLVE = 1, 2, 5
+COMPUTATIONS = {"rmm": 0, "energy": 1, "forces": 3}
+
+# Slater radii [Angstrom] and number of radial shells for the small and medium/big grids (lioamber/grid.f)
+ELEMENTS = {
+    # symbol: (Z, Rm, Nr, Nr2)
+    "H": (1, 0.35, 20, 30),
+    "C": (6, 0.70, 25, 35),
+    "N": (7, 0.65, 25, 35),
+    "O": (8, 0.60, 25, 35),
+    "Fe": (26, 1.40, 35, 45),
+}
+
+STO3G_1S = (0.15432897, 0.53532814, 0.44463454)
+STO3G_2SP_S = (-0.09996723, 0.39951283, 0.70011547)
+STO3G_2SP_P = (0.15591627, 0.60768372, 0.39195739)
+STO3G_3D = (0.21976795, 0.65554736, 0.28657326)
+STO3G_4SP_S = (-0.30884412, 0.01960641, 1.13103444)
+STO3G_4SP_P = (-0.12154686, 0.57152276, 0.54989495)
+
+# shells of each element: (angular momentum, exponents, contraction coefficients)
+BASIS = {
+    "H": [(0, (3.42525091, 0.62391373, 0.16885540), STO3G_1S)],
+    "C": [(0, (71.6168370, 13.0450960, 3.5305122), STO3G_1S),
+          (0, (2.9412494, 0.6834831, 0.2222899), STO3G_2SP_S),
+          (1, (2.9412494, 0.6834831, 0.2222899), STO3G_2SP_P)],
+    "N": [(0, (99.1061690, 18.0523120, 4.8856602), STO3G_1S),
+          (0, (3.7804559, 0.8784966, 0.2857144), STO3G_2SP_S),
+          (1, (3.7804559, 0.8784966, 0.2857144), STO3G_2SP_P)],
+    "O": [(0, (130.7093200, 23.8088610, 6.4436083), STO3G_1S),
+          (0, (5.0331513, 1.1695961, 0.3803890), STO3G_2SP_S),
+          (1, (5.0331513, 1.1695961, 0.3803890), STO3G_2SP_P)],
+    "Fe": [(0, (1079.2, 196.58, 53.20), STO3G_1S),
+           (0, (69.03, 16.04, 5.217), STO3G_2SP_S),
+           (1, (69.03, 16.04, 5.217), STO3G_2SP_P),
+           (0, (6.615, 2.012, 0.778), STO3G_2SP_S),
+           (1, (6.615, 2.012, 0.778), STO3G_2SP_P),
+           (2, (5.943, 1.742, 0.678), STO3G_3D),
+           (0, (0.700, 0.271, 0.121), STO3G_4SP_S),
+           (1, (0.700, 0.271, 0.121), STO3G_4SP_P)],
+}
+
+# Lebedev grids as octahedral orbits (base vector, weight / 4 pi), as in lioamber/grid.f
+SQ2 = math.sqrt(0.5)
+SQ3 = 1 / math.sqrt(3)
+A1, A2, A3 = (1, 0, 0), (SQ2, SQ2, 0), (SQ3, SQ3, SQ3)
+GRIDS = [
+    [(A1, 0.0126984126985), (A2, 0.0225749559083), (A3, 0.02109375),
+     ((0.301511344578, 0.301511344578, 0.904534033733), 0.0201733355379)],
+    [(A2, 0.00200918797730), (A3, 0.00988550016044),
+     ((0.162263300152, 0.162263300152, 0.973314565209), 0.00844068048232),
+     ((0.383386152638, 0.383386152638, 0.840255982384), 0.00987390742389),
+     ((0.686647945709, 0.686647945709, 0.238807866929), 0.0093573216900),
+     ((0.878158910604, 0.478369028812, 0), 0.00969499636166)],
+    [(A1, 0.00178234044724), (A2, 0.00571690594988), (A3, 0.00557338317884),
+     ((0.444693317871, 0.444693317871, 0.777493219315), 0.00551877146727),
+     ((0.289246562758, 0.289246562758, 0.912509096867), 0.00515823771181),
+     ((0.671297344270, 0.671297344270, 0.314196994183), 0.00560870408259),
+     ((0.129933544765, 0.129933544765, 0.982972302707), 0.00410677702817),
+     ((0.938319218138, 0.345770219761, 0), 0.00505184606462),
+     ((0.836036015482, 0.159041710538, 0.525118572443), 0.00553024891623)],
+]
+GRID_SIZES = [50, 116, 194]
+
+
+def angular_grid(orbits):
+    "Points and weights of the angular grid made of the given octahedral orbits"
+    points, weights = [], []
+    for base, weight in orbits:
+        orbit = set()
+        for perm in itertools.permutations(base):
+            for signs in itertools.product((1, -1), repeat=3):
+                orbit.add(tuple(round(s * x, 12) + 0.0 for s, x in zip(signs, perm)))
+        for point in sorted(orbit):
+            points.append(point)
+            weights.append(weight * 4 * math.pi)
+    return points, weights
+
+
+def primitive_norm(l, a):
+    "Normalization of a primitive x^l exp(-a r^2) (xy-like for d)"
+    return (2 * a / math.pi) ** 0.75 * (4 * a) ** (l / 2.0)
+
+
+def water(n):
+    "n water molecules on a cubic lattice with 3.1 Angstrom spacing"
+    side = int(math.ceil(n ** (1 / 3.0)))
+    atoms = []
+    for i in range(n):
+        x, y, z = 3.1 * (i % side), 3.1 * ((i // side) % side), 3.1 * (i // (side * side))
+        atoms += [("O", (x, y, z)), ("H", (x + 0.7572, y + 0.5865, z)), ("H", (x - 0.7572, y + 0.5865, z))]
+    return atoms
+
+
+def alkane(n):
+    "zigzag C_n H_2n+2 chain"
+    atoms = []
+    for i in range(n):
+        x, y = 1.26 * i, (0.89 if i % 2 else 0.0)
+        hy = y + (0.63 if i % 2 else -0.63)
+        atoms += [("C", (x, y, 0.0)), ("H", (x, hy, 0.89)), ("H", (x, hy, -0.89))]
+    atoms += [("H", (-1.09, 0.0, 0.0)), ("H", (1.26 * (n - 1) + 1.09, (0.89 if (n - 1) % 2 else 0.0), 0.0))]
+    return atoms
+
+
+def metal(n):
+    "n octahedral Fe(H2O)6 complexes, 7 Angstrom apart"
+    atoms = []
+    for i in range(n):
+        center = (7.0 * i, 0.0, 0.0)
+        atoms.append(("Fe", center))
+        for axis in range(3):
+            for sign in (1, -1):
+                direction = [0.0, 0.0, 0.0]
+                direction[axis] = sign
+                o = tuple(c + 2.1 * d for c, d in zip(center, direction))
+                # hydrogens in the plane of the next axis, pointing away from the metal
+                other = [0.0, 0.0, 0.0]
+                other[(axis + 1) % 3] = 1
+                atoms.append(("O", o))
+                for s in (1, -1):
+                    atoms.append(("H", tuple(oc + 0.59 * d + s * 0.76 * od for oc, d, od in zip(o, direction, other))))
+    return atoms
+
+
+SYSTEMS = {"water": water, "alkane": alkane, "metal": metal}
+
+
+def build_basis(atoms):
+    "Functions sorted as g2g expects them: all s, then p (3 components), then d (6 components)"
+    functions = {0: [], 1: [], 2: []}
+    for index, (symbol, _) in enumerate(atoms):
+        for l, exponents, coefficients in BASIS[symbol]:
+            functions[l].append((index, l, exponents, coefficients))
+
+    nuc, ncont, a, c = [], [], [], []
+    components = {0: 1, 1: 3, 2: 6}
+    for l in (0, 1, 2):
+        for index, _, exponents, coefficients in functions[l]:
+            for _ in range(components[l]):
+                nuc.append(index + 1)
+                ncont.append(len(exponents))
+                a.append(list(exponents))
+                c.append([d * primitive_norm(l, e) for e, d in zip(exponents, coefficients)])
+    nshell = [len(functions[0]), 3 * len(functions[1]), 6 * len(functions[2])]
+    return nuc, ncont, a, c, nshell
+
+
+def write_capture(name, system, size, grid_type, solves, computation, iexch):
+    atoms = SYSTEMS[system](size)
+    nuc, ncont, a, c, nshell = build_basis(atoms)
+    m = len(nuc)
+    electrons = sum(ELEMENTS[symbol][0] for symbol, _ in atoms)
+
+    # diagonal density: the electrons of each atom spread over its functions
+    functions_per_atom = [nuc.count(i + 1) for i in range(len(atoms))]
+    density = [0.0] * (m * (m + 1) // 2)
+    for i in range(m):
+        atom = nuc[i] - 1
+        density[i * m - (i * (i - 1)) // 2] = ELEMENTS[atoms[atom][0]][0] / float(functions_per_atom[atom])
+
+    out = open(name, "wb")
+    uints = lambda *values: out.write(struct.pack("=%dI" % len(values), *values))
+    doubles = lambda values: out.write(struct.pack("=%dd" % len(values), *values))
+
+    out.write(CAPTURE_MAGIC)
+    uints(CAPTURE_PARAMETERS)
+    uints(1, len(atoms), m, m, electrons // 2, 0, 0, 2 if computation == "forces" else 0, iexch, 6)
+    uints(*nshell)
+    for symbol, _ in atoms:
+        z, rm, nr, nr2 = ELEMENTS[symbol]
+        uints(z, nr, nr2)
+        doubles([rm / (2 * BOHR)])
+    for i in range(m):
+        uints(nuc[i], ncont[i])
+    for values in (a, c):
+        for j in range(MAX_CONTRACTIONS):
+            doubles([values[i][j] if j < len(values[i]) else 0.0 for i in range(m)])
+
+    grids = [angular_grid(orbits) for orbits in GRIDS]
+    for (points, _), size_ in zip(grids, GRID_SIZES):
+        assert len(points) == size_
+        for k in range(3):
+            doubles([p[k] for p in points])
+    for _, weights in grids:
+        doubles(weights)
+
+    uints(CAPTURE_POSITIONS, grid_type)
+    for k in range(3):
+        doubles([position[k] / BOHR for _, position in atoms])
+
+    for _ in range(solves):
+        uints(CAPTURE_SOLVE, COMPUTATIONS[computation])
+        doubles([0.0])
+        doubles(density)
+    out.close()
+
+    return len(atoms), m
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Write a synthetic g2g capture")
+    parser.add_argument("system", choices=sorted(SYSTEMS.keys()))
+    parser.add_argument("size", type=int, help="molecules, carbons or complexes")
+    parser.add_argument("-o", "--output", default="synthetic.cap")
+    parser.add_argument("--grid", type=int, choices=(0, 1, 2), default=1, help="grid type")
+    parser.add_argument("--solves", type=int, default=5, help="number of solves")
+    parser.add_argument("--computation", choices=sorted(COMPUTATIONS.keys()), default="rmm")
+    parser.add_argument("--iexch", type=int, default=9, help="functional (LIO Iexch)")
+    args = parser.parse_args()
+
+    atoms, m = write_capture(args.output, args.system, args.size, args.grid, args.solves, args.computation, args.iexch)
+    print("%s: %d atoms, %d functions" % (args.output, atoms, m))
+
+
+if __name__ == "__main__":
+    main()
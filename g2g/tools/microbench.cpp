@@ -0,0 +1,346 @@
+/**
+ * Microbenchmarks of the CPU kernels on a synthetic group, without LIO or a grid:
+ *
+ *   microbench [-a atoms] [-b s,p,d] [-c contractions] [-d 5|6] [-p points] [-k kernel,kernel,...]
+ *              [-f lda,gga] [-s float,double] [-t threads,threads,...] [-r repetitions] [-o output.json]
+ *
+ * The group has atoms atoms on a line (1.4 bohr apart), each with the given number of s, p and d shells of
+ * contractions primitives (d with 5 spherical or 6 cartesian components), and points spread uniformly (with a fixed
+ * seed) in the box around them. Every kernel is run repetitions times for each functional, precision and thread
+ * count; the minimum and mean times are printed and all of them written as JSON. Kernels:
+ *
+ *   weights     Becke weights of the points           functions   function tables (and derivatives for gga)
+ *   rmm_input   density matrix of the group           rmm_output  accumulation of the group Fock matrix
+ *   pot         exchange-correlation potential        density     point loop: density and potential
+ *   fock        Fock matrix update (syr of each point) forces     point loop with forces
+ *   solve       whole closed shell solve
+ *
+ * The solve kernels (density, forces, solve) include computing the functions when built with cpu_recompute=1.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cmath>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "../common.h"
+#include "../init.h"
+#include "../matrix.h"
+#include "../partition.h"
+#include "../cpu/pot.h"
+using namespace std;
+using namespace G2G;
+
+#if !CPU_KERNELS
+#error "microbench times the CPU kernels, build it with cpu=1"
+#endif
+
+template<class scalar_type>
+class SyntheticGroup : public PointGroup<scalar_type> {
+  public:
+    bool is_sphere(void) { return false; }
+    bool is_cube(void) { return true; }
+};
+
+/* storage of the fortran_vars matrices, which only point to it */
+struct Basis {
+  uint atoms, s, p, d, contractions;
+  vector<uint> nucleii, ncont;
+  vector<double> a, c, density, fock, forces;
+};
+
+static const double ATOM_SPACING = 1.4; // bohr
+static const double BOX_MARGIN = 2.0;   // bohr around the atoms where the points are placed
+
+static double wall_clock(void) {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static vector<string> split_list(const char* value) {
+  stringstream list(value);
+  vector<string> items;
+  string item;
+  while (getline(list, item, ',')) items.push_back(item);
+  return items;
+}
+
+/* 48 bit linear congruential generator (as drand48), so the points are the same on every platform */
+static double next_random(unsigned long long& state) {
+  state = (state * 0x5DEECE66DULL + 0xB) & ((1ULL << 48) - 1);
+  return (double)state / (double)(1ULL << 48);
+}
+
+static void add_shells(Basis& basis, uint components, uint shells_per_atom, uint& func) {
+  for (uint atom = 0; atom < basis.atoms; atom++) {
+    for (uint shell = 0; shell < shells_per_atom; shell++) {
+      for (uint k = 0; k < components; k++, func++) {
+        basis.nucleii[func] = atom + 1;
+        basis.ncont[func] = basis.contractions;
+        // exponents from diffuse to tight, shifted for each shell so they are not all shared
+        for (uint j = 0; j < basis.contractions; j++) {
+          basis.a[j * basis.nucleii.size() + func] = 0.15 * pow(4.0, (double)j) * pow(1.7, (double)shell);
+          basis.c[j * basis.nucleii.size() + func] = 1.0 / basis.contractions;
+        }
+      }
+    }
+  }
+}
+
+/* fortran_vars for the synthetic basis: functions ordered s, p, d as LIO does, with a diagonally dominant density */
+static void setup_basis(Basis& basis) {
+  if (basis.contractions == 0 || basis.contractions > MAX_CONTRACTIONS) throw runtime_error("contractions must be between 1 and MAX_CONTRACTIONS");
+  uint d_components = fortran_vars.d_components;
+  uint m = basis.atoms * (basis.s + basis.p * 3 + basis.d * d_components);
+  if (m == 0) throw runtime_error("the synthetic basis has no functions");
+
+  fortran_vars.atoms = fortran_vars.max_atoms = basis.atoms;
+  fortran_vars.gaussians = m;
+  fortran_vars.normalize = true;
+  fortran_vars.normalization_factor = 1.0 / sqrt(3.0);
+  fortran_vars.s_funcs = basis.atoms * basis.s;
+  fortran_vars.p_funcs = basis.atoms * basis.p;
+  fortran_vars.d_funcs = basis.atoms * basis.d;
+  fortran_vars.spd_funcs = fortran_vars.s_funcs + fortran_vars.p_funcs + fortran_vars.d_funcs;
+  fortran_vars.m = m;
+  fortran_vars.nco = 1;
+  fortran_vars.OPEN = false;
+  fortran_vars.nunp = 0;
+
+  basis.nucleii.assign(m, 0); basis.ncont.assign(m, 0);
+  basis.a.assign(m * MAX_CONTRACTIONS, 0); basis.c.assign(m * MAX_CONTRACTIONS, 0);
+  uint func = 0;
+  add_shells(basis, 1, basis.s, func);
+  add_shells(basis, 3, basis.p, func);
+  add_shells(basis, d_components, basis.d, func);
+  fortran_vars.nucleii = FortranMatrix<uint>(&basis.nucleii[0], m, 1, 1);
+  fortran_vars.contractions = FortranMatrix<uint>(&basis.ncont[0], m, 1, 1);
+  fortran_vars.a_values = FortranMatrix<double>(&basis.a[0], m, MAX_CONTRACTIONS, m);
+  fortran_vars.c_values = FortranMatrix<double>(&basis.c[0], m, MAX_CONTRACTIONS, m);
+
+  // packed upper triangle, as in RMM
+  basis.density.assign(m * m, 0);
+  for (uint i = 0; i < m; i++)
+    for (uint j = i; j < m; j++) basis.density[(i * m - (i * (i - 1)) / 2) + (j - i)] = (i == j ? 1.0 : 0.01);
+  basis.fock.assign((m * (m + 1)) / 2, 0);
+  fortran_vars.rmm_input_ndens1 = FortranMatrix<double>(&basis.density[0], m, m, m);
+  fortran_vars.rmm_output = FortranMatrix<double>(&basis.fock[0], (m * (m + 1)) / 2);
+  basis.forces.assign(basis.atoms * 3, 0);
+
+  fortran_vars.atom_positions.resize(basis.atoms);
+  fortran_vars.rm.resize(basis.atoms);
+  fortran_vars.atom_atom_dists.resize(basis.atoms, basis.atoms);
+  fortran_vars.nearest_neighbor_dists.resize(basis.atoms);
+  for (uint i = 0; i < basis.atoms; i++) {
+    fortran_vars.atom_positions(i) = make_double3(i * ATOM_SPACING, 0, 0);
+    fortran_vars.rm(i) = 1.0;
+    fortran_vars.nearest_neighbor_dists(i) = ATOM_SPACING;
+    for (uint j = 0; j < basis.atoms; j++) fortran_vars.atom_atom_dists(i, j) = fabs((double)i - (double)j) * ATOM_SPACING;
+  }
+}
+
+template<class scalar_type>
+static void setup_group(SyntheticGroup<scalar_type>& group, const Basis& basis, uint points) {
+  for (uint i = 0; i < basis.atoms; i++) group.local2global_nuc.push_back(i);
+  uint func = 0;
+  for (uint i = 0; i < basis.atoms * basis.s; i++, func += 1) group.local2global_func.push_back(func);
+  for (uint i = 0; i < basis.atoms * basis.p; i++, func += 3) group.local2global_func.push_back(func);
+  for (uint i = 0; i < basis.atoms * basis.d; i++, func += fortran_vars.d_components) group.local2global_func.push_back(func);
+  group.s_functions = basis.atoms * basis.s;
+  group.p_functions = basis.atoms * basis.p;
+  group.d_functions = basis.atoms * basis.d;
+  group.compute_nucleii_maps();
+
+  double3 box_min = make_double3(-BOX_MARGIN, -BOX_MARGIN, -BOX_MARGIN);
+  double3 box_size = make_double3((basis.atoms - 1) * ATOM_SPACING + 2 * BOX_MARGIN, 2 * BOX_MARGIN, 2 * BOX_MARGIN);
+  double weight = box_size.x * box_size.y * box_size.z / points;
+  unsigned long long state = 0x1234ABCD330EULL;
+  for (uint i = 0; i < points; i++) {
+    double3 position = make_double3(box_min.x + box_size.x * next_random(state), box_min.y + box_size.y * next_random(state),
+                                    box_min.z + box_size.z * next_random(state));
+    uint atom = min((uint)floor(max(position.x, 0.0) / ATOM_SPACING + 0.5), basis.atoms - 1);
+    group.add_point(Point(atom, 0, i, position, weight));
+  }
+}
+
+/* times repetitions runs of kernel on group; setup outside of the timed region is redone before each run */
+template<class scalar_type>
+static vector<double> run_kernel(const string& kernel, SyntheticGroup<scalar_type>& group, bool lda, uint repetitions, double* forces) {
+  typedef vec_type<scalar_type,3> vec3;
+  uint m = group.total_functions();
+  vector<double> seconds;
+  vector<Point> points(group.points);
+  HostMatrix<scalar_type> matrix;
+  vector<scalar_type> densities(group.number_of_points);
+  vector<vec3> gradients(group.number_of_points), hessians1(group.number_of_points), hessians2(group.number_of_points);
+  for (uint i = 0; i < group.number_of_points; i++) {
+    densities[i] = 0.01 + 0.5 * (i % 97) / 97.0;
+    gradients[i] = vec3(0.01 * (i % 7), 0.02, 0.005 * (i % 11));
+    hessians1[i] = vec3(0.1, 0.05 * (i % 3), 0.02);
+    hessians2[i] = vec3(0.01, 0.02, 0.03 * (i % 5));
+  }
+
+  for (uint r = 0; r < repetitions; r++) {
+    Timers timers;
+    double energy = 0;
+    bool with_forces = (kernel == "forces");
+    if (kernel == "weights") group.points = points;
+    else if (kernel == "rmm_input") matrix.resize(m, m);
+    else if (kernel == "rmm_output") matrix.resize(m, m).fill((scalar_type)1e-3);
+    else if (kernel == "fock" || kernel == "density" || kernel == "forces" || kernel == "solve") {
+      group.compute_functions(with_forces, !lda);
+      if (kernel == "fock") matrix.resize(m, m).zero();
+    }
+    else if (kernel != "functions" && kernel != "pot") throw runtime_error("unknown kernel " + kernel);
+
+    double t0 = wall_clock();
+    if (kernel == "weights") group.compute_weights();
+    else if (kernel == "functions") group.compute_functions(false, !lda);
+    else if (kernel == "rmm_input") group.get_rmm_input(matrix);
+    else if (kernel == "rmm_output") group.add_rmm_output(matrix);
+    else if (kernel == "pot") {
+      scalar_type total = 0;
+      #pragma omp parallel for reduction(+:total)
+      for (int i = 0; i < (int)densities.size(); i++) {
+        scalar_type exc = 0, corr = 0, y2a = 0;
+        if (lda) cpu_pot(densities[i], exc, corr, y2a);
+        else cpu_potg(densities[i], gradients[i], hessians1[i], hessians2[i], exc, corr, y2a);
+        total += exc + corr + y2a;
+      }
+      energy = total;
+    }
+    else if (kernel == "fock") {
+      for (uint i = 0; i < group.number_of_points; i++)
+        HostMatrix<scalar_type>::blas_ssyr(LowerTriangle, (scalar_type)group.points[i].weight, group.function_values, matrix, i);
+    }
+    else if (kernel == "density") group.solve_closed(timers, false, lda, false, true, energy, NULL);
+    else if (kernel == "forces") group.solve_closed(timers, false, lda, true, false, energy, forces);
+    else group.solve_closed(timers, true, lda, false, true, energy, NULL);
+    seconds.push_back(wall_clock() - t0);
+  }
+
+  group.points = points;
+  group.function_values.deallocate();
+  group.gradient_values.deallocate();
+  group.hessian_values.deallocate();
+  return seconds;
+}
+
+static void write_list(ostream& out, const char* name, const vector<double>& values) {
+  out << "\"" << name << "\": [";
+  for (uint i = 0; i < values.size(); i++) out << (i == 0 ? "" : ", ") << values[i];
+  out << "]";
+}
+
+template<class scalar_type>
+static void run_precision(const char* precision, const Basis& basis, uint points, const vector<string>& kernels, const vector<string>& functionals,
+                          const vector<int>& thread_counts, uint repetitions, ostream& out, bool& first_run) {
+  SyntheticGroup<scalar_type> group;
+  setup_group(group, basis, points);
+  kernel_precision = (sizeof(scalar_type) == sizeof(double) ? DOUBLE_PRECISION : SINGLE_PRECISION);
+
+  for (uint f = 0; f < functionals.size(); f++) {
+    bool lda = (functionals[f] == "lda");
+    if (!lda && functionals[f] != "gga") throw runtime_error("unknown functional " + functionals[f]);
+    fortran_vars.lda = lda;
+    fortran_vars.gga = !lda;
+    fortran_vars.iexch = (lda ? 3 : 9);
+
+    for (uint t = 0; t < thread_counts.size(); t++) {
+#ifdef _OPENMP
+      if (thread_counts[t] > 0) omp_set_num_threads(thread_counts[t]);
+      int threads = omp_get_max_threads();
+#else
+      int threads = 1;
+#endif
+      for (uint k = 0; k < kernels.size(); k++) {
+        vector<double> seconds = run_kernel(kernels[k], group, lda, repetitions, (double*)&basis.forces[0]);
+        double best = *min_element(seconds.begin(), seconds.end()), mean = 0;
+        for (uint i = 0; i < seconds.size(); i++) mean += seconds[i] / seconds.size();
+
+        cout << setw(10) << left << kernels[k] << " " << functionals[f] << " " << setw(6) << precision << " " << right << setw(3) << threads
+             << " threads: min " << setw(10) << (uint)(best * 1e6) << " us. mean " << setw(10) << (uint)(mean * 1e6) << " us. "
+             << best * 1e9 / ((double)group.number_of_points * group.total_functions()) << " ns per point and function" << endl;
+
+        out << (first_run ? "" : ",\n") << "    {\"kernel\": \"" << kernels[k] << "\", \"functional\": \"" << functionals[f]
+            << "\", \"precision\": \"" << precision << "\", \"threads\": " << threads << ", ";
+        write_list(out, "seconds", seconds);
+        out << "}";
+        first_run = false;
+      }
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  Basis basis;
+  basis.atoms = 4; basis.s = 3; basis.p = 2; basis.d = 1; basis.contractions = 3;
+  uint points = 1000, repetitions = 5;
+  vector<string> kernels = split_list("weights,functions,rmm_input,rmm_output,pot,density,fock,forces,solve");
+  vector<string> functionals = split_list("lda,gga");
+  vector<string> precisions = split_list("float,double");
+  vector<int> thread_counts;
+  string output = "microbench.json";
+
+  for (int i = 1; i < argc; i += 2) {
+    if (i + 1 == argc) { cerr << "missing value of " << argv[i] << endl; return 1; }
+    string option(argv[i]);
+    if (option == "-a") basis.atoms = atoi(argv[i + 1]);
+    else if (option == "-b") {
+      vector<string> shells = split_list(argv[i + 1]);
+      if (shells.size() != 3) { cerr << "-b takes the s,p,d shells of each atom" << endl; return 1; }
+      basis.s = atoi(shells[0].c_str()); basis.p = atoi(shells[1].c_str()); basis.d = atoi(shells[2].c_str());
+    }
+    else if (option == "-c") basis.contractions = atoi(argv[i + 1]);
+    else if (option == "-d") spherical_d_functions = (atoi(argv[i + 1]) == 5);
+    else if (option == "-p") points = atoi(argv[i + 1]);
+    else if (option == "-k") kernels = split_list(argv[i + 1]);
+    else if (option == "-f") functionals = split_list(argv[i + 1]);
+    else if (option == "-s") precisions = split_list(argv[i + 1]);
+    else if (option == "-r") repetitions = atoi(argv[i + 1]);
+    else if (option == "-o") output = argv[i + 1];
+    else if (option == "-t") {
+      vector<string> threads = split_list(argv[i + 1]);
+      for (uint t = 0; t < threads.size(); t++) thread_counts.push_back(atoi(threads[t].c_str()));
+    }
+    else { cerr << "unknown argument " << argv[i] << endl; return 1; }
+  }
+  if (thread_counts.empty()) thread_counts.push_back(0); // OpenMP default
+  if (basis.atoms == 0 || points == 0 || repetitions == 0) { cerr << "atoms, points and repetitions must be positive" << endl; return 1; }
+
+  // the synthetic weights are kept as they come out, and the group keeps all of its points
+  remove_zero_weights = false;
+  fortran_vars.d_components = (spherical_d_functions ? 5 : 6);
+  setup_basis(basis);
+
+  ofstream out(output.c_str());
+  if (!out) throw runtime_error("could not open " + output);
+  out.precision(10);
+  out << "{" << endl;
+  out << "  \"atoms\": " << basis.atoms << ", \"s\": " << basis.s << ", \"p\": " << basis.p << ", \"d\": " << basis.d
+      << ", \"d_components\": " << fortran_vars.d_components << ", \"contractions\": " << basis.contractions
+      << ", \"m\": " << fortran_vars.m << ", \"points\": " << points << "," << endl;
+  out << "  \"runs\": [" << endl;
+
+  cout << "synthetic group: " << basis.atoms << " atoms, " << fortran_vars.m << " functions, " << points << " points" << endl;
+  bool first_run = true;
+  for (uint s = 0; s < precisions.size(); s++) {
+    if (precisions[s] == "float") run_precision<float>("float", basis, points, kernels, functionals, thread_counts, repetitions, out, first_run);
+    else if (precisions[s] == "double") run_precision<double>("double", basis, points, kernels, functionals, thread_counts, repetitions, out, first_run);
+    else { cerr << "unknown precision " << precisions[s] << endl; return 1; }
+  }
+
+  out << endl << "  ]" << endl;
+  out << "}" << endl;
+  cout << "microbench results written to " << output << endl;
+  return 0;
+}
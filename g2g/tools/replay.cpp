@@ -0,0 +1,270 @@
+/**
+ * Replays a capture written with the capture_file option through the g2g entry points, without LIO:
+ *
+ *   replay <capture file> [-r repetitions] [-t threads,threads,...] [-o output.json]
+ *
+ * For each thread count and repetition the whole capture is replayed (grid builds and solves, in the
+ * captured order). Grid build and solve times and the difference of the energies with the captured
+ * ones are written as JSON. The gpu_options file of the working directory is read as usual.
+ */
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <time.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#include "../common.h"
+#include "../init.h"
+#include "../capture.h"
+using namespace std;
+using namespace G2G;
+
+extern "C" void g2g_parameter_init_(const unsigned int& norm, const unsigned int& natom, const unsigned int& max_atoms, const unsigned int& ngaussians,
+                                    double* r, double* Rm, const unsigned int* Iz, const unsigned int* Nr, const unsigned int* Nr2, unsigned int* Nuc,
+                                    const unsigned int& M, unsigned int* ncont, const unsigned int* nshell, double* c, double* a,
+                                    double* RMM, const unsigned int& M18, const unsigned int& M5, const unsigned int& M3, double* rhoalpha, double* rhobeta,
+                                    const unsigned int& nco, bool& OPEN, const unsigned int& nunp, const unsigned int& nopt, const unsigned int& Iexch,
+                                    const double& told, double* e, double* e2, double* e3, double* wang, double* wang2, double* wang3);
+extern "C" void g2g_reload_atom_positions_(const unsigned int& grid_type);
+extern "C" void g2g_new_grid_(const unsigned int& grid_type);
+extern "C" void g2g_scf_convergence_(double& good);
+extern "C" void g2g_solve_groups_(const uint& computation_type, double* fort_energy_ptr, double* fort_forces_ptr);
+
+/* one captured call after g2g_parameter_init_ */
+struct Event {
+  uint32_t tag, grid_type, computation_type;
+  double value; // convergence or captured energy
+  vector<double> positions, density_a, density_b;
+};
+
+struct Capture {
+  uint32_t norm, atoms, gaussians, m, nco, open, nunp, nopt, iexch, d_components, nshell[3];
+  vector<unsigned int> Iz, Nr, Nr2, Nuc, ncont;
+  vector<double> Rm, a, c, e, e2, e3, wang, wang2, wang3;
+  vector<Event> events;
+};
+
+static uint32_t read_uint(istream& in) {
+  uint32_t value;
+  if (!in.read((char*)&value, sizeof(value))) throw runtime_error("truncated capture file");
+  return value;
+}
+
+static double read_double(istream& in) {
+  double value;
+  if (!in.read((char*)&value, sizeof(value))) throw runtime_error("truncated capture file");
+  return value;
+}
+
+static void read_doubles(istream& in, vector<double>& values, size_t count) {
+  values.resize(count);
+  for (size_t i = 0; i < count; i++) values[i] = read_double(in);
+}
+
+static void read_capture(const char* name, Capture& capture) {
+  ifstream in(name, ios::binary);
+  if (!in) throw runtime_error(string("could not open ") + name);
+
+  char magic[sizeof(CAPTURE_MAGIC)];
+  if (!in.read(magic, sizeof(magic)) || memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0) throw runtime_error(string("not a capture file: ") + name);
+  if (read_uint(in) != CAPTURE_PARAMETERS) throw runtime_error("capture file does not start with the parameters");
+
+  capture.norm = read_uint(in); capture.atoms = read_uint(in); capture.gaussians = read_uint(in); capture.m = read_uint(in);
+  capture.nco = read_uint(in); capture.open = read_uint(in); capture.nunp = read_uint(in); capture.nopt = read_uint(in);
+  capture.iexch = read_uint(in); capture.d_components = read_uint(in);
+  for (uint k = 0; k < 3; k++) capture.nshell[k] = read_uint(in);
+
+  // Nr, Nr2 and Rm are indexed by atomic number
+  vector<unsigned int> Nr(capture.atoms), Nr2(capture.atoms);
+  vector<double> Rm(capture.atoms);
+  for (uint i = 0; i < capture.atoms; i++) {
+    capture.Iz.push_back(read_uint(in));
+    Nr[i] = read_uint(in); Nr2[i] = read_uint(in); Rm[i] = read_double(in);
+  }
+  uint max_z = *max_element(capture.Iz.begin(), capture.Iz.end());
+  capture.Nr.assign(max_z + 1, 0); capture.Nr2.assign(max_z + 1, 0); capture.Rm.assign(max_z + 1, 0);
+  for (uint i = 0; i < capture.atoms; i++) {
+    capture.Nr[capture.Iz[i]] = Nr[i]; capture.Nr2[capture.Iz[i]] = Nr2[i]; capture.Rm[capture.Iz[i]] = Rm[i];
+  }
+
+  for (uint i = 0; i < capture.m; i++) { capture.Nuc.push_back(read_uint(in)); capture.ncont.push_back(read_uint(in)); }
+
+  // a and c have leading dimension gaussians in g2g_parameter_init_
+  vector<double> a, c;
+  read_doubles(in, a, capture.m * MAX_CONTRACTIONS);
+  read_doubles(in, c, capture.m * MAX_CONTRACTIONS);
+  capture.a.assign(capture.gaussians * MAX_CONTRACTIONS, 0); capture.c.assign(capture.gaussians * MAX_CONTRACTIONS, 0);
+  for (uint j = 0; j < MAX_CONTRACTIONS; j++) {
+    for (uint i = 0; i < capture.m; i++) {
+      capture.a[j * capture.gaussians + i] = a[j * capture.m + i];
+      capture.c[j * capture.gaussians + i] = c[j * capture.m + i];
+    }
+  }
+
+  read_doubles(in, capture.e, SMALL_GRID_SIZE * 3);
+  read_doubles(in, capture.e2, MEDIUM_GRID_SIZE * 3);
+  read_doubles(in, capture.e3, BIG_GRID_SIZE * 3);
+  read_doubles(in, capture.wang, SMALL_GRID_SIZE);
+  read_doubles(in, capture.wang2, MEDIUM_GRID_SIZE);
+  read_doubles(in, capture.wang3, BIG_GRID_SIZE);
+
+  uint32_t tag;
+  size_t packed = (capture.m * (capture.m + 1)) / 2;
+  while (in.read((char*)&tag, sizeof(tag))) {
+    Event event;
+    event.tag = tag;
+    event.grid_type = event.computation_type = 0;
+    event.value = 0;
+    switch (tag) {
+      case CAPTURE_POSITIONS:
+        event.grid_type = read_uint(in);
+        read_doubles(in, event.positions, capture.atoms * 3);
+      break;
+      case CAPTURE_NEW_GRID:
+        event.grid_type = read_uint(in);
+      break;
+      case CAPTURE_CONVERGENCE:
+        event.value = read_double(in);
+      break;
+      case CAPTURE_SOLVE:
+        event.computation_type = read_uint(in);
+        event.value = read_double(in);
+        read_doubles(in, event.density_a, packed);
+        if (capture.open) read_doubles(in, event.density_b, packed);
+      break;
+      default:
+        throw runtime_error("unknown record in capture file");
+    }
+    capture.events.push_back(event);
+  }
+}
+
+static double wall_clock(void) {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec * 1e-9;
+}
+
+static void write_list(ostream& out, const char* name, const vector<double>& values) {
+  out << "\"" << name << "\": [";
+  for (uint i = 0; i < values.size(); i++) out << (i == 0 ? "" : ", ") << values[i];
+  out << "]";
+}
+
+int main(int argc, char** argv) {
+  if (argc < 2) {
+    cerr << "usage: " << argv[0] << " <capture file> [-r repetitions] [-t threads,threads,...] [-o output.json]" << endl;
+    return 1;
+  }
+
+  uint repetitions = 1;
+  vector<int> thread_counts;
+  string output = "replay.json";
+  for (int i = 2; i + 1 < argc; i += 2) {
+    if (string(argv[i]) == "-r") repetitions = atoi(argv[i + 1]);
+    else if (string(argv[i]) == "-o") output = argv[i + 1];
+    else if (string(argv[i]) == "-t") {
+      stringstream list(argv[i + 1]);
+      string item;
+      while (getline(list, item, ',')) thread_counts.push_back(atoi(item.c_str()));
+    }
+    else { cerr << "unknown argument " << argv[i] << endl; return 1; }
+  }
+  if (thread_counts.empty()) thread_counts.push_back(0); // OpenMP default
+
+  Capture capture;
+  read_capture(argv[1], capture);
+
+  uint m = capture.m;
+  size_t packed = (m * (m + 1)) / 2;
+  unsigned int M5 = m * m + 1, M3 = M5 + packed, M18 = M3 + packed;
+  vector<double> RMM(M18 - 1 + m, 0), rhoalpha(m * m, 0), rhobeta(m * m, 0);
+  vector<double> positions(capture.atoms * 3, 0), forces(capture.atoms * 3, 0);
+  bool open = capture.open;
+
+  g2g_parameter_init_(capture.norm, capture.atoms, capture.atoms, capture.gaussians, &positions[0], &capture.Rm[0], &capture.Iz[0],
+                      &capture.Nr[0], &capture.Nr2[0], &capture.Nuc[0], m, &capture.ncont[0], capture.nshell, &capture.c[0], &capture.a[0],
+                      &RMM[0], M18, M5, M3, &rhoalpha[0], &rhobeta[0], capture.nco, open, capture.nunp, capture.nopt, capture.iexch,
+                      0.0 /* no SCF criterion */, &capture.e[0], &capture.e2[0], &capture.e3[0], &capture.wang[0], &capture.wang2[0], &capture.wang3[0]);
+  if (fortran_vars.d_components != capture.d_components)
+    cerr << "warning: the capture has " << capture.d_components << " d components, gpu_options gives " << fortran_vars.d_components << endl;
+
+  ofstream out(output.c_str());
+  if (!out) throw runtime_error("could not open " + output);
+  out.precision(10);
+  out << "{" << endl;
+  out << "  \"capture\": \"" << argv[1] << "\", \"atoms\": " << capture.atoms << ", \"m\": " << m << ", \"open\": " << capture.open << "," << endl;
+  out << "  \"runs\": [" << endl;
+
+  for (uint t = 0; t < thread_counts.size(); t++) {
+#ifdef _OPENMP
+    if (thread_counts[t] > 0) omp_set_num_threads(thread_counts[t]);
+    int threads = omp_get_max_threads();
+#else
+    int threads = 1;
+#endif
+
+    for (uint r = 0; r < repetitions; r++) {
+      vector<double> grid_seconds, solve_seconds, energy_errors;
+      for (uint i = 0; i < capture.events.size(); i++) {
+        const Event& event = capture.events[i];
+        double t0 = wall_clock();
+        switch (event.tag) {
+          case CAPTURE_POSITIONS:
+            copy(event.positions.begin(), event.positions.end(), positions.begin());
+            g2g_reload_atom_positions_(event.grid_type);
+            grid_seconds.push_back(wall_clock() - t0);
+          break;
+          case CAPTURE_NEW_GRID:
+            g2g_new_grid_(event.grid_type);
+            grid_seconds.push_back(wall_clock() - t0);
+          break;
+          case CAPTURE_CONVERGENCE: {
+            double good = event.value;
+            g2g_scf_convergence_(good);
+          }
+          break;
+          case CAPTURE_SOLVE: {
+            if (open) {
+              copy(event.density_a.begin(), event.density_a.end(), rhoalpha.begin());
+              copy(event.density_b.begin(), event.density_b.end(), rhobeta.begin());
+            }
+            else copy(event.density_a.begin(), event.density_a.end(), RMM.begin());
+            fill(RMM.begin() + (M5 - 1), RMM.end(), 0.0);
+            fill(forces.begin(), forces.end(), 0.0);
+
+            double energy = 0;
+            t0 = wall_clock();
+            g2g_solve_groups_(event.computation_type, &energy, &forces[0]);
+            solve_seconds.push_back(wall_clock() - t0);
+            energy_errors.push_back(energy - event.value);
+          }
+          break;
+        }
+      }
+
+      double max_error = 0;
+      for (uint i = 0; i < energy_errors.size(); i++) max_error = max(max_error, fabs(energy_errors[i]));
+
+      out << "    {\"threads\": " << threads << ", \"repetition\": " << r << ", ";
+      write_list(out, "grid_seconds", grid_seconds); out << ", ";
+      write_list(out, "solve_seconds", solve_seconds); out << ", ";
+      write_list(out, "energy_errors", energy_errors); out << ", ";
+      out << "\"max_energy_error\": " << max_error << "}";
+      out << (t + 1 == thread_counts.size() && r + 1 == repetitions ? "" : ",") << endl;
+    }
+  }
+
+  out << "  ]" << endl;
+  out << "}" << endl;
+  cout << "replay results written to " << output << endl;
+  return 0;
+}
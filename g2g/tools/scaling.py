@@ -0,0 +1,165 @@
+#!/usr/bin/env python2.7
+"""
+Strong and weak scaling of the XC integration over system size, grid type and thread count, using
+synthetic captures (generate_capture.py) and the replay tool (make replay, in g2g).
+
+For each system, size and grid a capture is generated and replayed for every thread count. The grid
+build time, the solve time and, if g2g was built with time=1, the time of each solve phase (as printed
+by g2g) are recorded. Strong scaling is the speedup over the smallest thread count at a fixed size;
+weak scaling compares runs whose size grows with the thread count (size = base size * threads).
+"""
+
+from __future__ import print_function
+
+import argparse
+import json
+import os
+import re
+import subprocess
+
+import generate_capture
+
+SEC_TO_USEC = 1000 * 1000
+PHASES = ["rmm", "density", "pot", "forces", "resto", "functions"]
+
+
+def parse_timer(text):
+    "Microseconds of a g2g timer printed as '[Xs. ]Yus.'"
+    m = re.match(r"(?:(\d+)s\. )?(\d+)us\.", text)
+    if not m:
+        return None
+    sec, usec = m.groups()
+    return float(sec or 0) * SEC_TO_USEC + float(usec)
+
+
+def parse_phases(output):
+    "Phase times (seconds) of each solve in the replay output, in order"
+    solves = []
+    for line in output.splitlines():
+        if not line.startswith("rmm: "):
+            continue
+        phases = {}
+        for phase in PHASES:
+            m = re.search(r"\b%s: ((?:\d+s\. )?\d+us\.)" % phase, line)
+            if m:
+                phases[phase] = parse_timer(m.group(1)) / SEC_TO_USEC
+        solves.append(phases)
+    return solves
+
+
+def mean(values):
+    return sum(values) / float(len(values)) if values else 0.0
+
+
+def run(args, system, size, grid):
+    "Replays one synthetic capture for all the thread counts, returns a record per thread count"
+    capture = os.path.join(args.workdir, "%s_%d_%d.cap" % (system, size, grid))
+    report = capture + ".json"
+    atoms, functions = generate_capture.write_capture(capture, system, size, grid, args.solves, args.computation, args.iexch)
+
+    command = [args.replay, capture, "-r", str(args.repetitions), "-t", ",".join(str(t) for t in args.threads), "-o", report]
+    output = subprocess.check_output(command, cwd=args.workdir, universal_newlines=True)
+    result = json.load(open(report))
+    phases = parse_phases(output)
+
+    records = []
+    for index, run in enumerate(result["runs"]):
+        record = records[-1] if records and records[-1]["threads"] == run["threads"] else None
+        if record is None:
+            record = {"system": system, "size": size, "atoms": atoms, "functions": functions, "grid": grid,
+                      "threads": run["threads"], "grid_seconds": [], "solve_seconds": [], "phases": {}}
+            records.append(record)
+        record["grid_seconds"].append(sum(run["grid_seconds"]))
+        record["solve_seconds"].append(mean(run["solve_seconds"]))
+
+        # one phase line per solve, in the same order as the solves of the runs
+        solves = len(run["solve_seconds"])
+        run_phases = phases[index * solves:(index + 1) * solves]
+        for phase in PHASES:
+            times = [p[phase] for p in run_phases if phase in p]
+            if times:
+                record["phases"].setdefault(phase, []).append(mean(times))
+
+    # best of the repetitions
+    for record in records:
+        record["grid_seconds"] = min(record["grid_seconds"])
+        record["solve_seconds"] = min(record["solve_seconds"])
+        record["phases"] = dict((phase, min(values)) for phase, values in record["phases"].items())
+    return records
+
+
+def strong_scaling(records):
+    "Speedup and efficiency over the smallest thread count of each system, size and grid"
+    curves = []
+    keys = sorted(set((r["system"], r["size"], r["grid"]) for r in records))
+    for system, size, grid in keys:
+        runs = sorted((r for r in records if (r["system"], r["size"], r["grid"]) == (system, size, grid)), key=lambda r: r["threads"])
+        base = runs[0]
+        points = []
+        for r in runs:
+            speedup = base["solve_seconds"] / r["solve_seconds"] if r["solve_seconds"] > 0 else 0.0
+            points.append({"threads": r["threads"], "solve_seconds": r["solve_seconds"], "grid_seconds": r["grid_seconds"],
+                           "speedup": speedup, "efficiency": speedup * base["threads"] / r["threads"]})
+        curves.append({"system": system, "size": size, "grid": grid, "points": points})
+    return curves
+
+
+def weak_scaling(records, base_size):
+    "Efficiency of the runs with size = base_size * threads, relative to the one with the fewest threads"
+    curves = []
+    for system, grid in sorted(set((r["system"], r["grid"]) for r in records)):
+        runs = sorted((r for r in records if r["system"] == system and r["grid"] == grid and r["size"] == base_size * r["threads"]),
+                      key=lambda r: r["threads"])
+        if not runs:
+            continue
+        base = runs[0]
+        points = [{"threads": r["threads"], "size": r["size"], "atoms": r["atoms"], "solve_seconds": r["solve_seconds"],
+                   "efficiency": base["solve_seconds"] / r["solve_seconds"] if r["solve_seconds"] > 0 else 0.0} for r in runs]
+        curves.append({"system": system, "grid": grid, "points": points})
+    return curves
+
+
+def int_list(text):
+    return [int(x) for x in text.split(",")]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Scaling curves of g2g on synthetic systems")
+    parser.add_argument("--replay", default=os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "replay"))
+    parser.add_argument("--systems", default="water,alkane,metal")
+    parser.add_argument("--sizes", type=int_list, default=[1, 2, 4, 8, 16, 32])
+    parser.add_argument("--grids", type=int_list, default=[1])
+    parser.add_argument("--threads", type=int_list, default=[1, 2, 4, 8])
+    parser.add_argument("--weak_base", type=int, default=1, help="size per thread of the weak scaling curves")
+    parser.add_argument("--repetitions", type=int, default=3)
+    parser.add_argument("--solves", type=int, default=3)
+    parser.add_argument("--computation", choices=sorted(generate_capture.COMPUTATIONS.keys()), default="rmm")
+    parser.add_argument("--iexch", type=int, default=9)
+    parser.add_argument("--workdir", default=".", help="where the captures are written (and gpu_options is read)")
+    parser.add_argument("--output", default="scaling.json")
+    args = parser.parse_args()
+    args.replay = os.path.abspath(args.replay)
+
+    records = []
+    for system in args.systems.split(","):
+        for size in args.sizes:
+            for grid in args.grids:
+                print("%s %d, grid %d" % (system, size, grid))
+                records += run(args, system, size, grid)
+
+    result = {"runs": records, "strong_scaling": strong_scaling(records), "weak_scaling": weak_scaling(records, args.weak_base)}
+    with open(args.output, "w") as out:
+        json.dump(result, out, indent=2, sort_keys=True)
+
+    csv = os.path.splitext(args.output)[0] + ".csv"
+    with open(csv, "w") as out:
+        out.write("system,size,atoms,functions,grid,threads,grid_seconds,solve_seconds,%s\n" % ",".join(PHASES))
+        for r in records:
+            phases = ",".join("%g" % r["phases"][p] if p in r["phases"] else "" for p in PHASES)
+            out.write("%s,%d,%d,%d,%d,%d,%g,%g,%s\n" % (r["system"], r["size"], r["atoms"], r["functions"], r["grid"], r["threads"],
+                                                        r["grid_seconds"], r["solve_seconds"], phases))
+    print("results written to %s and %s" % (args.output, csv))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,153 @@
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <time.h>
+#include "common.h"
+#include "init.h"
+#include "trace.h"
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace std;
+
+namespace G2G {
+
+bool tracing = false;
+
+#define TRACE_BUFFER_EVENTS (1 << 16) // per thread, a power of two
+
+struct TraceEvent {
+  const char* name;
+  unsigned long long ns; // since the trace started
+  int points, functions; // -1 if not a group solve
+  char phase;
+};
+
+/* ring of the last events of a thread, in its own cache line: count is the number of events ever added,
+   the oldest ones are overwritten */
+struct TraceBuffer {
+  TraceEvent* events;
+  unsigned long long count;
+  char padding[64 - sizeof(TraceEvent*) - sizeof(unsigned long long)];
+};
+
+static FILE* trace_stream = NULL;
+static TraceBuffer* trace_buffers = NULL;
+static unsigned int trace_threads = 0;
+static timespec trace_start;
+static bool first_event;
+
+static unsigned long long trace_clock(void) {
+  timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return (unsigned long long)(t.tv_sec - trace_start.tv_sec) * 1000000000ULL + t.tv_nsec - trace_start.tv_nsec;
+}
+
+static void write_name(const char* name) {
+  fputc('"', trace_stream);
+  for (const char* c = name; *c; c++) {
+    if (*c == '"' || *c == '\\') fputc('\\', trace_stream);
+    fputc(*c, trace_stream);
+  }
+  fputc('"', trace_stream);
+}
+
+/* writes the events kept by the ring of a thread, oldest first. When older events were overwritten, the end
+   events whose begin was lost are skipped; returns the number of events that were overwritten */
+static unsigned long long write_buffer(unsigned int thread) {
+  const TraceBuffer& buffer = trace_buffers[thread];
+  unsigned long long first = (buffer.count > TRACE_BUFFER_EVENTS ? buffer.count - TRACE_BUFFER_EVENTS : 0);
+  int open_events = 0;
+  for (unsigned long long i = first; i < buffer.count; i++) {
+    const TraceEvent& event = buffer.events[i & (TRACE_BUFFER_EVENTS - 1)];
+    if (event.phase == 'B') open_events++;
+    else if (open_events == 0) continue;
+    else open_events--;
+
+    fputs(first_event ? "\n" : ",\n", trace_stream);
+    first_event = false;
+    fputs("{\"name\":", trace_stream);
+    write_name(event.name);
+    fprintf(trace_stream, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u", event.phase, event.ns * 1e-3, thread);
+    if (event.points >= 0) fprintf(trace_stream, ",\"args\":{\"points\":%d,\"functions\":%d}", event.points, event.functions);
+    fputc('}', trace_stream);
+  }
+  return first;
+}
+
+void trace_open(void) {
+  if (trace_file.empty()) return;
+
+  trace_close();
+  trace_stream = fopen(trace_file.c_str(), "w");
+  if (!trace_stream) throw runtime_error(string("Could not open trace file ") + trace_file);
+
+#ifdef _OPENMP
+  trace_threads = omp_get_max_threads();
+#else
+  trace_threads = 1;
+#endif
+  void* memory;
+  if (posix_memalign(&memory, 64, trace_threads * sizeof(TraceBuffer)) != 0) throw std::bad_alloc();
+  trace_buffers = (TraceBuffer*)memory;
+  for (uint i = 0; i < trace_threads; i++) {
+    trace_buffers[i].events = new TraceEvent[TRACE_BUFFER_EVENTS];
+    trace_buffers[i].count = 0;
+  }
+
+  fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", trace_stream);
+  first_event = true;
+  for (uint i = 0; i < trace_threads; i++) {
+    fprintf(trace_stream, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}",
+      first_event ? "" : ",", i, i);
+    first_event = false;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &trace_start);
+  tracing = true;
+  cout << "tracing to " << trace_file << endl;
+}
+
+void trace_close(void) {
+  if (!trace_stream) return;
+
+  tracing = false;
+  unsigned long long overwritten = 0;
+  for (uint i = 0; i < trace_threads; i++) {
+    overwritten += write_buffer(i);
+    delete[] trace_buffers[i].events;
+  }
+  if (overwritten > 0) cout << "trace: the " << overwritten << " oldest events were overwritten" << endl;
+  free(trace_buffers);
+  trace_buffers = NULL;
+  trace_threads = 0;
+
+  fputs("\n]}\n", trace_stream);
+  fclose(trace_stream);
+  trace_stream = NULL;
+}
+
+/* teams larger than the default one (explicit num_threads) only trace their first trace_threads threads */
+void trace_event(const char* name, char phase, int points, int functions) {
+#ifdef _OPENMP
+  uint thread = omp_get_thread_num();
+#else
+  uint thread = 0;
+#endif
+  if (thread >= trace_threads) return;
+
+  TraceBuffer& buffer = trace_buffers[thread];
+  TraceEvent& event = buffer.events[buffer.count++ & (TRACE_BUFFER_EVENTS - 1)];
+  event.name = name;
+  event.ns = trace_clock();
+  event.points = points;
+  event.functions = functions;
+  event.phase = phase;
+}
+
+}
@@ -0,0 +1,26 @@
+#ifndef __G2G_TRACE_H__
+#define __G2G_TRACE_H__
+
+namespace G2G {
+  /**
+   * Timeline of the run (option trace_file) in the Chrome trace-event format, to be opened in Perfetto
+   * or about:tracing: begin/end events of the Fortran timers (only in time=1 builds), each group solve
+   * and the phases of the kernels, per OpenMP thread. Each thread appends to its own ring buffer, which
+   * keeps its last TRACE_BUFFER_EVENTS events, and the file is only written at g2g_deinit, so tracing
+   * never stops a thread. Names are not copied: they must outlive the trace.
+   */
+  extern bool tracing;
+
+  void trace_open(void);  // starts tracing if trace_file is set
+  void trace_close(void); // writes the pending events and closes the file
+
+  void trace_event(const char* name, char phase, int points, int functions);
+
+  inline void trace_begin(const char* name) { if (tracing) trace_event(name, 'B', -1, -1); }
+  inline void trace_end(const char* name) { if (tracing) trace_event(name, 'E', -1, -1); }
+
+  /* a group solve, with its size as arguments */
+  inline void trace_begin(const char* name, int points, int functions) { if (tracing) trace_event(name, 'B', points, functions); }
+}
+
+#endif
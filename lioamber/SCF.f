@@ -903,6 +903,8 @@ c            RMM(kk)=RMM(kk)+ff*X(i,M2+k)*X(j,M2+k)
        enddo
 c
        good=sqrt(good)/float(M)
+c g2g raises good when auto_grid refines the grid, for one more iteration
+       call g2g_scf_convergence(good)
 
        if (SHFT) then
 c Level Shifting
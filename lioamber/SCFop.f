@@ -12,6 +12,8 @@ c---------------------------------------------------
       use garcha_mod
       use mathsubs
       REAL*8:: En,E2,E,Es,Ex,Exc
+c good goes to g2g_scf_convergence, which takes a double
+      REAL*8:: good
 
       dimension work(1000)
       real*8, dimension (:,:), ALLOCATABLE ::xnano,znano
@@ -1106,6 +1108,8 @@ c
        enddo
 c
        good=sqrt(good)/float(M)
+c g2g raises good when auto_grid refines the grid, for one more iteration
+       call g2g_scf_convergence(good)
 c
 c--- Damping factor update - 
        DAMP=DAMP0
@@ -893,7 +893,7 @@ c      write(*,*) 'estoooo',ngpru, ngDyn, ng0, natom
      >                        rqm,Rm2,Iz,Nr,Nr2,Nuc,
      >                        M,ncont,nshell,c,a, 
      >                        RMM,M18,M5,M3,rhoalpha,rhobeta,
-     >                        NCO,OPEN,Nunp,nopt,Iexch,
+     >                        NCO,OPEN,Nunp,nopt,Iexch,told,
      >                        e_, e_2, e3, wang, wang2, wang3)
 
 c      write(*,*) '======>>>> SALIENDO DE DRIVE <<<<=========='
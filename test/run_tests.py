@@ -2,6 +2,8 @@
 
 import argparse
 import fileinput
+import json
+import math
 import os
 import re
 import subprocess
@@ -25,6 +27,7 @@ def get_statistics(out_file):
     scf_energy = []
     iteration_time = []
     convergence_at = []
+    iteration_summary = None
 
     for line in out_file.readlines():
         # Iteration output line
@@ -37,13 +40,18 @@ def get_statistics(out_file):
         if m:
             scf_energy.append(float(m.group(1)))
 
-        # Iteration time output line
+        # Iteration time output line (older outputs print one per iteration)
         m = re.match("TIMER \[Total iter\]: (?:(\d+)s. )?(\d+)us.",line)
         if m:
             sec,usec = m.groups()
             sec = sec or 0
             iteration_time.append(float(sec)*SEC_TO_USEC+float(usec))
 
+        # Iteration line of the timer summary: calls, total, min, mean and max seconds
+        m = re.match(r"TIMER\s+Total iter\s+(\d+)\s+([0-9.]+)\s+[0-9.]+\s+([0-9.]+)\s+[0-9.]+", line)
+        if m:
+            iteration_summary = (float(m.group(2))*SEC_TO_USEC, float(m.group(3))*SEC_TO_USEC)
+
         # Iteration convergence output line
         m = re.match(" CONVERGED AT \s+(\d+) ITERATIONS", line)
         if m:
@@ -52,11 +60,16 @@ def get_statistics(out_file):
     if len(scf_energy) < 1:
         return None
 
+    if iteration_summary:
+        total_time, avg_time = iteration_summary
+    else:
+        total_time, avg_time = sum(iteration_time), avg(iteration_time)
+
     return Summary(
             iterations=max(iterations),\
             converged=len(convergence_at) > 0,\
-            total_time=sum(iteration_time),\
-            avg_time=avg(iteration_time),\
+            total_time=total_time,\
+            avg_time=avg_time,\
             scf_energy=scf_energy[-1])
 
 # Tolerance parameters
@@ -168,9 +181,167 @@ def run_tests(dirs_with_tests):
 
     return failed
 
+# Benchmark mode: timings per iteration (usec) and peak memory (MB) of repeated runs, against the
+# samples stored in each test directory as BASELINE_FILE
+BENCHMARK_METRICS = ["iteration_time", "xc_time", "grid_time", "peak_memory"]
+BASELINE_FILE = "benchmark.ok"
+
+def parse_timer(text):
+    "Microseconds of a g2g timer printed as '[Xs. ]Yus.'"
+    m = re.match(r"(?:(\d+)s\. )?(\d+)us\.", text)
+    sec, usec = m.groups()
+    return float(sec or 0)*SEC_TO_USEC + float(usec)
+
+def get_benchmark(out_file, peak_memory):
+    "Get the metrics of a LIO run out file (built with time=1), None for the ones it doesn't print"
+
+    xc_time = []
+    grid_time = []
+    for line in out_file.readlines():
+        # XC iteration (g2g)
+        m = re.match(r"iteration: ((?:\d+s\. )?\d+us\.)", line)
+        if m:
+            xc_time.append(parse_timer(m.group(1)))
+
+        # Grid build (g2g)
+        m = re.match(r"timer grilla: ((?:\d+s\. )?\d+us\.)", line)
+        if m:
+            grid_time.append(parse_timer(m.group(1)))
+
+    out_file.seek(0)
+    summary = get_statistics(out_file)
+
+    return {
+        "iteration_time": summary.avg_time if summary else None,
+        "xc_time": avg(xc_time) if xc_time else None,
+        "grid_time": avg(grid_time) if grid_time else None,
+        "peak_memory": peak_memory }
+
+def lio_benchmark_run(dir, lioenv, out):
+    "Run Lio script writing to out, returns its error code and peak resident memory (MB)"
+    execpath = ["./correr.sh", out]
+    process = subprocess.Popen(execpath, env=lioenv, cwd=os.path.abspath(dir))
+    # wait4 gives the resource usage of the script and of the LIO run it waited for
+    _, status, usage = os.wait4(process.pid, 0)
+    process.returncode = os.WEXITSTATUS(status) if os.WIFEXITED(status) else -1
+    return process.returncode, usage.ru_maxrss / 1024.
+
+def mean_std(samples):
+    mean = avg(samples)
+    if len(samples) < 2:
+        return mean, 0.
+    return mean, math.sqrt(sum((x - mean)**2 for x in samples) / (len(samples) - 1))
+
+# One sided 95% critical values of the Student t distribution, by degrees of freedom
+T_CRITICAL = [6.314, 2.920, 2.353, 2.132, 2.015, 1.943, 1.895, 1.860, 1.833, 1.812]
+
+def t_critical(df):
+    if df < 1:
+        return T_CRITICAL[0]
+    if df <= len(T_CRITICAL):
+        return T_CRITICAL[int(df) - 1]
+    if df <= 20:
+        return 1.725
+    if df <= 30:
+        return 1.697
+    return 1.645
+
+MIN_TEST_SAMPLES = 2 # per side, below this the variance is unknown and nothing is called significant
+
+def compare_samples(current, baseline, min_slowdown):
+    "Welch's t test of current > baseline, significant only if the slowdown is also above min_slowdown"
+    current_mean, current_std = mean_std(current)
+    baseline_mean, baseline_std = mean_std(baseline)
+    slowdown = (current_mean - baseline_mean) / baseline_mean if baseline_mean > 0 else 0.
+
+    current_var = current_std**2 / len(current)
+    baseline_var = baseline_std**2 / len(baseline)
+    if current_var + baseline_var > 0:
+        t = (current_mean - baseline_mean) / math.sqrt(current_var + baseline_var)
+        df_den = (current_var**2 / (len(current) - 1) if len(current) > 1 else 0) + \
+                 (baseline_var**2 / (len(baseline) - 1) if len(baseline) > 1 else 0)
+        df = (current_var + baseline_var)**2 / df_den if df_den > 0 else 1
+    else:
+        t = float("inf") if current_mean > baseline_mean else 0.
+        df = len(current) + len(baseline) - 2
+
+    testable = len(current) >= MIN_TEST_SAMPLES and len(baseline) >= MIN_TEST_SAMPLES
+    return {
+        "current": {"mean": current_mean, "std": current_std, "samples": current},
+        "baseline": {"mean": baseline_mean, "std": baseline_std, "samples": baseline},
+        "slowdown": slowdown,
+        "t": t if t != float("inf") and testable else None,
+        "too_few_samples": not testable,
+        "significant": testable and slowdown > min_slowdown and t > t_critical(df) }
+
+def run_benchmarks(dirs_with_tests, repetitions, update_baselines, report_file, min_slowdown):
+    "Run each test several times and compare its metrics with its baseline"
+
+    lioenv = lio_env()
+    report = {}
+    regressions = 0
+
+    for dir in dirs_with_tests:
+        print("Benchmarking %s..." % dir)
+
+        print "\tRecompiling..."
+        errcode = recompile_lio(dir, lioenv)
+        if errcode != 0:
+            print "\tFailed to recompile"
+            break
+
+        samples = dict((metric, []) for metric in BENCHMARK_METRICS)
+        for r in range(repetitions):
+            print "\tRun %d of %d..." % (r + 1, repetitions)
+            errcode, peak_memory = lio_benchmark_run(dir, lioenv, "salida.bench")
+            if errcode != 0:
+                print "\tFailed to run with errcode %d" % errcode
+                break
+            with open(os.path.join(dir, "salida.bench"), "r") as f:
+                metrics = get_benchmark(f, peak_memory)
+            for metric in BENCHMARK_METRICS:
+                if metrics[metric] is not None:
+                    samples[metric].append(metrics[metric])
+        if errcode != 0:
+            break
+
+        baseline_path = os.path.join(dir, BASELINE_FILE)
+        if update_baselines or not os.path.isfile(baseline_path):
+            with open(baseline_path, "w") as f:
+                json.dump(samples, f, indent=2, sort_keys=True)
+            print "\tBaseline written to %s" % baseline_path
+            report[dir] = {"baseline_updated": True}
+            continue
+
+        with open(baseline_path, "r") as f:
+            baseline = json.load(f)
+
+        report[dir] = {}
+        for metric in BENCHMARK_METRICS:
+            if not samples[metric] or not baseline.get(metric):
+                continue
+            result = compare_samples(samples[metric], baseline[metric], min_slowdown)
+            report[dir][metric] = result
+            print "\t%s: %f (baseline %f, %+.1f %%)%s" % (metric, result["current"]["mean"], result["baseline"]["mean"],
+                100.0 * result["slowdown"], " SLOWER" if result["significant"] else
+                (" (too few samples to test, need %d per side)" % MIN_TEST_SAMPLES if result["too_few_samples"] else ""))
+            if result["significant"]:
+                regressions += 1
+
+    with open(report_file, "w") as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+    print "Benchmark report written to %s" % report_file
+
+    return regressions
+
 if __name__ == '__main__':
     parser = argparse.ArgumentParser()
     parser.add_argument("--filter_rx", help="Expresion regular para filtrar que tests se corren", default=".*")
+    parser.add_argument("--benchmark", action="store_true", help="compare timings and memory with the baselines instead of the results")
+    parser.add_argument("--repetitions", type=int, default=5, help="runs of each test in benchmark mode")
+    parser.add_argument("--update_baselines", action="store_true", help="store the benchmark results as the new baselines")
+    parser.add_argument("--benchmark_report", default="benchmark.json", help="JSON report of the benchmark mode")
+    parser.add_argument("--min_slowdown", type=float, default=0.05, help="smallest relative slowdown reported as a regression")
     args = parser.parse_args()
     filterrx = args.filter_rx
 
@@ -179,6 +350,13 @@ if __name__ == '__main__':
     subdirs = list(os.walk('.'))[0][1]
     dirs_with_tests = sorted([d for d in subdirs if re.search(filterrx,d)])
 
+    if args.benchmark:
+        regressions = run_benchmarks(dirs_with_tests, args.repetitions, args.update_baselines, args.benchmark_report, args.min_slowdown)
+        if regressions > 0:
+            print "%d metrics got slower..." % regressions
+            sys.exit(1)
+        sys.exit(0)
+
     failed = run_tests(dirs_with_tests)
     if failed > 0:
         print "%d tests fallaron..." % failed